@@ -0,0 +1,45 @@
+#include <stddef.h>
+
+#include "passes.hpp"
+
+// Sits in front of malloc for `--mem-passes` and the bench. This replaces the allocator for the
+// whole process, so only the codegen's own binaries link it, never the glue. ASan brings its own
+// malloc, which this would fight with, so there it leaves everything alone.
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define ALLOC_COUNT_ASAN
+#endif
+#endif
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__) && !defined(ALLOC_COUNT_ASAN)
+using namespace codegen;
+
+static inline void count(size_t size) {
+    if (counting_allocations.load(std::memory_order_relaxed) != 0) {
+        allocation_counts.allocations++;
+        allocation_counts.bytes_allocated += size;
+    }
+}
+
+extern "C" {
+    void* __libc_malloc(size_t);
+    void* __libc_calloc(size_t, size_t);
+    void* __libc_realloc(void*, size_t);
+
+    void* malloc(size_t size) {
+        count(size);
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count_, size_t size) {
+        count(count_ * size);
+        return __libc_calloc(count_, size);
+    }
+
+    void* realloc(void* ptr, size_t size) {
+        count(size);
+        return __libc_realloc(ptr, size);
+    }
+}
+#endif
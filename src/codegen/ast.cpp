@@ -108,10 +108,7 @@ string unescape(const string& s) {
 }
 
 string to_cpp_str(string_t str) {
-    char new_str[str.len];
-    sprintf(new_str, "%2$.*1$s", str.len, str.s);
-    string new_cpp = new_str;
-    return new_cpp;
+    return string(str.s, str.len);
 }
 
 BinaryFlavor to_cpp_binary(binop_t binary_op_c) {
@@ -191,51 +188,66 @@ UnaryFlavor to_cpp_unary(unop_t unary_op_c) {
     }
 }
 
-StringExpression to_cpp_expression(expr_t* expr_c) {
+ExpressionRef to_cpp_expression(StringArena& arena, expr_t* expr_c) {
     switch (expr_c->kind) {
-        case expr::EXPR_BINARY:
-            return BinaryOperation<string> {
-                left: make_gross<StringExpression>(to_cpp_expression(expr_c->value.binary.lhs)),
+        case expr::EXPR_BINARY: {
+            ExpressionRef left = to_cpp_expression(arena, expr_c->value.binary.lhs);
+            ExpressionRef right = to_cpp_expression(arena, expr_c->value.binary.rhs);
+
+            return arena.add(BinaryOperation {
+                left: left,
                 flavor: to_cpp_binary(expr_c->value.binary.op),
-                right: make_gross<StringExpression>(to_cpp_expression(expr_c->value.binary.rhs)),
-            };
+                right: right,
+            });
             break;
+        }
+
+        case expr::EXPR_UNARY: {
+            ExpressionRef content = to_cpp_expression(arena, expr_c->value.unary.subexpr);
 
-        case expr::EXPR_UNARY:
-            return UnaryOperation<string> {
+            return arena.add(UnaryOperation {
                 flavor: to_cpp_unary(expr_c->value.unary.op),
-                content: make_gross<StringExpression>(to_cpp_expression(expr_c->value.unary.subexpr)),
-            };
+                content: content,
+            });
             break;
+        }
 
         case expr::EXPR_CALL: {
-            vector<StringExpression> args = {};
+            size_t mark = arena.pending_expressions.size();
 
             for (size_t i = 0; i < arr_get_size(expr_c->value.call.args); i++) {
-                args.push_back(to_cpp_expression(&arr_at(expr_c->value.call.args, i)));
+                ExpressionRef arg = to_cpp_expression(arena, &arr_at(expr_c->value.call.args, i));
+                arena.pending_expressions.push_back(arg);
             }
 
-            return Call<string> {
-                function: make_gross<StringExpression>(to_cpp_expression(expr_c->value.call.func)),
+            ExpressionList args = arena.finish_expressions(mark);
+            ExpressionRef function = to_cpp_expression(arena, expr_c->value.call.func);
+
+            return arena.add(Call {
+                function: function,
                 args: args,
-            };
+            });
             break;
         }
 
-        case expr::EXPR_INDEX:
-            return Index<string> {
-                list: make_gross<StringExpression>(to_cpp_expression(expr_c->value.index.array)),
-                number: make_gross<StringExpression>(to_cpp_expression(expr_c->value.index.index)),
-            };
+        case expr::EXPR_INDEX: {
+            ExpressionRef list = to_cpp_expression(arena, expr_c->value.index.array);
+            ExpressionRef number = to_cpp_expression(arena, expr_c->value.index.index);
+
+            return arena.add(Index {
+                list: list,
+                number: number,
+            });
             break;
+        }
 
         case expr::EXPR_BOOL:
-            return BooleanLiteral { value: expr_c->value.bool_expr};
+            return arena.add(BooleanLiteral { value: expr_c->value.bool_expr});
             break;
 
         case expr::EXPR_NUMBER:
             // This cast may not make sense, I'm not sure what the parse is doing?
-            return IntegerLiteral { value: static_cast<int64_t>(expr_c->value.number) };
+            return arena.add(IntegerLiteral { value: static_cast<int64_t>(expr_c->value.number) });
             break;
 
         case expr::EXPR_STRING: {
@@ -245,136 +257,142 @@ StringExpression to_cpp_expression(expr_t* expr_c) {
             string stripped = str.substr(1, str.size() - 2);
 
             if (is_escaped) {
-                return StringLiteral { value: unescape(stripped) };
+                return arena.add(StringLiteral { value: unescape(stripped) });
             } else {
-                return StringLiteral { value: stripped };
+                return arena.add(StringLiteral { value: stripped });
             }
             break;
         }
 
         case expr::EXPR_IDENT:
-            return Identifier<string> { value: to_cpp_str(expr_c->value.string) };
+            return arena.add(Identifier<string> { value: to_cpp_str(expr_c->value.string) });
             break;
 
         case expr::EXPR_ARRAY: {
-            vector<StringExpression> args = {};
+            size_t mark = arena.pending_expressions.size();
 
             for (size_t i = 0; i < arr_get_size(expr_c->value.array); i++) {
-                args.push_back(to_cpp_expression(&arr_at(expr_c->value.array, i)));
+                ExpressionRef arg = to_cpp_expression(arena, &arr_at(expr_c->value.array, i));
+                arena.pending_expressions.push_back(arg);
             }
 
-            return ListLiteral<string> { value: args };
+            return arena.add(ListLiteral { value: arena.finish_expressions(mark) });
             break;
         }
 
         case expr::EXPR_NULL:
-            return NullLiteral {};
+            return arena.add(NullLiteral {});
             break;
         
         default:
             panic();
-            return NullLiteral {}; // Unreachable, makes the compiler happy
+            return arena.add(NullLiteral {}); // Unreachable, makes the compiler happy
             break;
     }
 }
 
 // Forward declaration for blocks
-vector<StringStatement> to_cpp_body(block_t*);
+StatementList to_cpp_body(StringArena&, block_t*);
 
-StringStatement to_cpp_statement(stmt_t* stmt_c) {
+StatementRef to_cpp_statement(StringArena& arena, stmt_t* stmt_c) {
     switch (stmt_c->kind) {
         case stmt_t::STMT_IF: {
             if_stmt_t if_c = stmt_c->value.if_stmt;
-            vector<std::tuple<Expression<string>, vector<Statement<string>>>> if_pairs = {};
+            size_t mark = arena.pending_if_pairs.size();
 
-            if_pairs.push_back(std::tuple<Expression<string>, vector<Statement<string>>>{
-                to_cpp_expression(if_c.main_cond),
-                to_cpp_body(&if_c.main_block)
+            ExpressionRef main_cond = to_cpp_expression(arena, if_c.main_cond);
+            arena.pending_if_pairs.push_back(IfPair {
+                condition: main_cond,
+                body: to_cpp_body(arena, &if_c.main_block),
             });
 
             for (size_t i = 0; i < arr_get_size(if_c.elif_conds); i++) {
-                if_pairs.push_back(std::tuple<Expression<string>, vector<Statement<string>>>{
-                    to_cpp_expression(&arr_at(if_c.elif_conds, i)),
-                    to_cpp_body(&arr_at(if_c.elif_blocks, i))
+                ExpressionRef cond = to_cpp_expression(arena, &arr_at(if_c.elif_conds, i));
+                arena.pending_if_pairs.push_back(IfPair {
+                    condition: cond,
+                    body: to_cpp_body(arena, &arr_at(if_c.elif_blocks, i)),
                 });
             }
 
-            std::optional<vector<StringStatement>> body = stmt_c->value.if_stmt.else_block == NULL ? 
-                std::nullopt
-                : std::optional<vector<StringStatement>>(to_cpp_body(&stmt_c->value.if_stmt.else_block));
+            IfPairList if_pairs = arena.finish_if_pairs(mark);
 
-            if (stmt_c->value.if_stmt.else_block != NULL) {
-            }
+            std::optional<StatementList> body = stmt_c->value.if_stmt.else_block == NULL ? 
+                std::nullopt
+                : std::optional<StatementList>(to_cpp_body(arena, &stmt_c->value.if_stmt.else_block));
 
-            return If<string> {
+            return arena.add(If {
                 if_pairs: if_pairs,
                 else_body: body,
-            };
-            return Do<string> {
-                content: NullLiteral {},
-            };
+            });
             break;
         }
 
-        case stmt_t::STMT_WHILE:
-            return While<string> {
-                condition: to_cpp_expression(stmt_c->value.while_stmt.cond),
-                body: to_cpp_body(&stmt_c->value.while_stmt.block),
-            };
+        case stmt_t::STMT_WHILE: {
+            ExpressionRef condition = to_cpp_expression(arena, stmt_c->value.while_stmt.cond);
+
+            return arena.add(While {
+                condition: condition,
+                body: to_cpp_body(arena, &stmt_c->value.while_stmt.block),
+            });
             break;
+        }
 
         case stmt_t::STMT_RETURN:
-            return Return<string> {
-                content: to_cpp_expression(stmt_c->value.expr),
-            };
+            return arena.add(Return {
+                content: to_cpp_expression(arena, stmt_c->value.expr),
+            });
             break;
 
         case stmt_t::STMT_DECLARE_VAR:
-            return VariableDeclaration<string> {
+            return arena.add(VariableDeclaration<string> {
                 identifier: to_cpp_str(stmt_c->value.declare_var.ident),
-                content: to_cpp_expression(stmt_c->value.declare_var.value),
-            };
+                content: to_cpp_expression(arena, stmt_c->value.declare_var.value),
+            });
             break;
 
         case stmt_t::STMT_ASSIGN_VAR: {
-            vector<StringExpression> indexes = {};
+            size_t mark = arena.pending_expressions.size();
 
             for (size_t i = 0; i < arr_get_size(stmt_c->value.assign_var.indices); i++) {
-                indexes.push_back(to_cpp_expression(&arr_at(stmt_c->value.assign_var.indices, i)));
+                ExpressionRef index = to_cpp_expression(arena, &arr_at(stmt_c->value.assign_var.indices, i));
+                arena.pending_expressions.push_back(index);
             }
 
-            return Assignment<string> {
+            ExpressionList indexes = arena.finish_expressions(mark);
+
+            return arena.add(Assignment<string> {
                 identifier: to_cpp_str(stmt_c->value.assign_var.ident),
                 indexes: indexes,
-                content: to_cpp_expression(stmt_c->value.assign_var.value),
-            };
+                content: to_cpp_expression(arena, stmt_c->value.assign_var.value),
+            });
             break;
         }
 
         case stmt_t::STMT_DO:
-            return Do<string> {
-                content: to_cpp_expression(stmt_c->value.expr),
-            };
+            return arena.add(Do {
+                content: to_cpp_expression(arena, stmt_c->value.expr),
+            });
             break;
 
         default:
             panic();
-            return Do<string> { content: to_cpp_expression(stmt_c->value.expr) }; // Unreachable, makes the compiler happy 
+            return arena.add(Do { content: to_cpp_expression(arena, stmt_c->value.expr) }); // Unreachable, makes the compiler happy 
             break;
     }
 }
 
-vector<StringStatement> to_cpp_body(block_t* body_c) {
-    vector<StringStatement> statements = {};
+StatementList to_cpp_body(StringArena& arena, block_t* body_c) {
+    size_t mark = arena.pending_statements.size();
 
     for (size_t i = 0; i < arr_get_size(*body_c); i++) {
-        statements.push_back(to_cpp_statement(&arr_at(*body_c, i)));
+        StatementRef statement = to_cpp_statement(arena, &arr_at(*body_c, i));
+        arena.pending_statements.push_back(statement);
     }
 
-    return statements;
+    return arena.finish_statements(mark);
 }
 
-StringFunction to_cpp_function(fn_decl_t* function_c) {
+StringFunction to_cpp_function(StringArena& arena, fn_decl_t* function_c) {
     vector<string> parms = {};
 
     for (size_t i = 0; i < arr_get_size(function_c->args); i++) {
@@ -384,28 +402,29 @@ StringFunction to_cpp_function(fn_decl_t* function_c) {
     return StringFunction {
         identifier: to_cpp_str(function_c->name),
         parms: parms,
-        body: to_cpp_body(&function_c->block),
+        body: to_cpp_body(arena, &function_c->block),
+        frame_size: 0,
     };
 }
 
 namespace codegen {
     StringAST to_cpp_ast(program_t* program_c) {
-        vector<StringDeclaration> declarations = {};
+        StringAST ast = {};
 
         for (size_t i = 0; i < arr_get_size(*program_c); i++) {
             decl_t declaration_c = arr_at(*program_c, i);
 
             switch (declaration_c.kind) {
                 case decl_t::DECL_FUNCTION:
-                    declarations.push_back(to_cpp_function(&declaration_c.value.fn));
+                    ast.declarations.push_back(to_cpp_function(ast.arena, &declaration_c.value.fn));
                     break;
 
                 case decl_t::DECL_GLOBAL:
-                    declarations.push_back(Global { identifier: to_cpp_str(declaration_c.value.string) });
+                    ast.declarations.push_back(Global { identifier: to_cpp_str(declaration_c.value.string) });
                     break;
 
                 case decl_t::DECL_IMPORT:
-                    declarations.push_back(Import { path: to_cpp_str(declaration_c.value.string) });
+                    ast.declarations.push_back(Import { path: to_cpp_str(declaration_c.value.string) });
                     break;
                 
                 default: 
@@ -414,6 +433,6 @@ namespace codegen {
             }
         }
 
-        return StringAST { declarations: declarations };
+        return ast;
     }
 }
\ No newline at end of file
@@ -6,6 +6,7 @@ extern "C"
 }
 
 #include <optional>
+#include <span>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -20,55 +21,66 @@ using vector = std::vector<T>;
 #define AST_CODEGEN
 
 namespace codegen {
-    template<typename T>
-    struct GrossPtr {
-        vector<T> value;
-
-        T get() const {
-            return value[0];
-        }
+    /*
+     * Nodes don't own their children. Every expression and statement lives in a per-kind pool
+     * inside the AST's Arena, and parents point at children with a (kind, 32-bit index) pair.
+     * Runs of children (list elements, call arguments, block bodies) are stored back to back in
+     * a shared pool, so a node only has to remember where its run starts and how long it is.
+     */
+
+    enum class ExpressionKind : uint8_t {
+        NullLiteral,
+        BooleanLiteral,
+        IntegerLiteral,
+        StringLiteral,
+        ListLiteral,
+        Identifier,
+        BinaryOperation,
+        UnaryOperation,
+        Index,
+        Call,
     };
 
-    template<typename T>
-    GrossPtr<T> make_gross(T t) {
-        return GrossPtr<T> { value: {t}};
-    }
-
-    template<typename T>
-    GrossPtr<T> make_gross(T);
-
-    // Forward declaration, so the recursive variant works
-
-    struct NullLiteral;
-    struct BooleanLiteral;
-    struct IntegerLiteral;
-    struct StringLiteral;
-    
-    template<typename T>
-    struct ListLiteral;
+    struct ExpressionRef {
+        ExpressionKind kind;
+        uint32_t index;
+    };
 
-    template<typename T>
-    struct Identifier;
+    // A run of `count` ExpressionRefs starting at `start` in Arena::expression_lists
+    struct ExpressionList {
+        uint32_t start;
+        uint32_t count;
+    };
 
-    template<typename T>
-    struct BinaryOperation;
+    enum class StatementKind : uint8_t {
+        If,
+        While,
+        Return,
+        Assignment,
+        VariableDeclaration,
+        Do,
+    };
 
-    template<typename T>
-    struct UnaryOperation;
+    struct StatementRef {
+        StatementKind kind;
+        uint32_t index;
+    };
 
-    template<typename T>
-    struct Index;
+    // A run of `count` StatementRefs starting at `start` in Arena::statement_lists
+    struct StatementList {
+        uint32_t start;
+        uint32_t count;
+    };
 
-    template<typename T>
-    struct Call;
+    // A run of `count` IfPairs starting at `start` in Arena::if_pairs
+    struct IfPairList {
+        uint32_t start;
+        uint32_t count;
+    };
 
-    template<typename T>
-    using Expression = std::variant<
-        NullLiteral, BooleanLiteral, IntegerLiteral,
-        StringLiteral, ListLiteral<T>, Identifier<T>,
-        BinaryOperation<T>, UnaryOperation<T>, Index<T>,
-        Call<T>
-    >;
+    /*
+     * Expressions
+     */
 
     struct NullLiteral {};
 
@@ -84,9 +96,8 @@ namespace codegen {
         string value;
     };
 
-    template<typename T>
     struct ListLiteral {
-        vector<Expression<T>> value;
+        ExpressionList value;
     };
 
     template<typename T>
@@ -110,11 +121,10 @@ namespace codegen {
         ModulousOrRemainder,
     };
 
-    template<typename T>
     struct BinaryOperation {
-        GrossPtr<Expression<T>> left;
+        ExpressionRef left;
         BinaryFlavor flavor;
-        GrossPtr<Expression<T>> right;
+        ExpressionRef right;
     };
 
     enum UnaryFlavor {
@@ -122,84 +132,255 @@ namespace codegen {
         Not,
     };
 
-    template<typename T>
     struct UnaryOperation {
         UnaryFlavor flavor;
-        GrossPtr<Expression<T>> content;
+        ExpressionRef content;
     };
 
-    template<typename T>
     struct Index {
-        GrossPtr<Expression<T>> list;
-        GrossPtr<Expression<T>> number;
+        ExpressionRef list;
+        ExpressionRef number;
     };
 
-    template<typename T>
     struct Call {
-        GrossPtr<Expression<T>> function;
-        vector<Expression<T>> args;
+        ExpressionRef function;
+        ExpressionList args;
     };
 
-    // More forward declaration
-    template<typename T>
-    struct Do;
+    /*
+     * Statements
+     */
 
-    template<typename T>
-    struct VariableDeclaration;
-
-    template<typename T>
-    struct Assignment;
-
-    template<typename T>
-    struct Return;
-
-    template<typename T>
-    struct While;
-
-    template<typename T>
-    struct If;
-
-    template<typename T>
-    using Statement = std::variant<
-        If<T>, While<T>, Return<T>,
-        Assignment<T>, VariableDeclaration<T>, Do<T>
-    >;
-
-    template<typename T>
     struct Do {
-        Expression<T> content;
+        ExpressionRef content;
     };
 
     template<typename T>
     struct VariableDeclaration {
         T identifier;
-        Expression<T> content;
+        ExpressionRef content;
     };
 
     template<typename T>
     struct Assignment {
         T identifier;
-        vector<Expression<T>> indexes; 
-        Expression<T> content;
+        ExpressionList indexes;
+        ExpressionRef content;
     };
 
-    template<typename T>
     struct Return {
-        Expression<T> content;
+        ExpressionRef content;
     };
 
-    template<typename T>
     struct While {
-        Expression<T> condition;
-        vector<Statement<T>> body;
+        ExpressionRef condition;
+        StatementList body;
+    };
+
+    struct IfPair {
+        ExpressionRef condition;
+        StatementList body;
     };
 
-    template<typename T>
     struct If {
-        vector<std::tuple<Expression<T>, vector<Statement<T>>>> if_pairs;
-        std::optional<vector<Statement<T>>> else_body;
+        IfPairList if_pairs;
+        std::optional<StatementList> else_body;
+    };
+
+    /*
+     * Pools
+     */
+
+    // Everything that doesn't mention an identifier, so it can be shared as-is between ASTs
+    struct ArenaNodes {
+        vector<BooleanLiteral> boolean_literals;
+        vector<IntegerLiteral> integer_literals;
+        vector<StringLiteral> string_literals;
+        vector<ListLiteral> list_literals;
+        vector<BinaryOperation> binary_operations;
+        vector<UnaryOperation> unary_operations;
+        vector<Index> indexes;
+        vector<Call> calls;
+
+        vector<If> ifs;
+        vector<IfPair> if_pairs;
+        vector<While> whiles;
+        vector<Return> returns;
+        vector<Do> dos;
+
+        vector<ExpressionRef> expression_lists;
+        vector<StatementRef> statement_lists;
+
+        std::span<const ExpressionRef> expressions(ExpressionList l) const {
+            return std::span<const ExpressionRef>(expression_lists.data() + l.start, l.count);
+        }
+
+        std::span<const StatementRef> statements(StatementList l) const {
+            return std::span<const StatementRef>(statement_lists.data() + l.start, l.count);
+        }
+
+        std::span<const IfPair> pairs(IfPairList l) const {
+            return std::span<const IfPair>(if_pairs.data() + l.start, l.count);
+        }
+    };
+
+    template<typename T>
+    struct Arena : ArenaNodes {
+        vector<Identifier<T>> identifiers;
+        vector<Assignment<T>> assignments;
+        vector<VariableDeclaration<T>> variable_declarations;
+
+        // Children are collected here while they're being built (which can push grandchildren),
+        // then moved into the shared pool in one go so that each run stays contiguous
+        vector<ExpressionRef> pending_expressions;
+        vector<StatementRef> pending_statements;
+        vector<IfPair> pending_if_pairs;
+
+        ExpressionRef add(NullLiteral) {
+            return ExpressionRef { kind: ExpressionKind::NullLiteral, index: 0 };
+        }
+
+        ExpressionRef add(BooleanLiteral e) {
+            return push(boolean_literals, e, ExpressionKind::BooleanLiteral);
+        }
+
+        ExpressionRef add(IntegerLiteral e) {
+            return push(integer_literals, e, ExpressionKind::IntegerLiteral);
+        }
+
+        ExpressionRef add(StringLiteral e) {
+            return push(string_literals, std::move(e), ExpressionKind::StringLiteral);
+        }
+
+        ExpressionRef add(ListLiteral e) {
+            return push(list_literals, e, ExpressionKind::ListLiteral);
+        }
+
+        ExpressionRef add(Identifier<T> e) {
+            return push(identifiers, std::move(e), ExpressionKind::Identifier);
+        }
+
+        ExpressionRef add(BinaryOperation e) {
+            return push(binary_operations, e, ExpressionKind::BinaryOperation);
+        }
+
+        ExpressionRef add(UnaryOperation e) {
+            return push(unary_operations, e, ExpressionKind::UnaryOperation);
+        }
+
+        ExpressionRef add(Index e) {
+            return push(indexes, e, ExpressionKind::Index);
+        }
+
+        ExpressionRef add(Call e) {
+            return push(calls, e, ExpressionKind::Call);
+        }
+
+        StatementRef add(If s) {
+            return push(ifs, s, StatementKind::If);
+        }
+
+        StatementRef add(While s) {
+            return push(whiles, s, StatementKind::While);
+        }
+
+        StatementRef add(Return s) {
+            return push(returns, s, StatementKind::Return);
+        }
+
+        StatementRef add(Assignment<T> s) {
+            return push(assignments, std::move(s), StatementKind::Assignment);
+        }
+
+        StatementRef add(VariableDeclaration<T> s) {
+            return push(variable_declarations, std::move(s), StatementKind::VariableDeclaration);
+        }
+
+        StatementRef add(Do s) {
+            return push(dos, s, StatementKind::Do);
+        }
+
+        ExpressionList finish_expressions(size_t mark) {
+            auto [start, count] = flush(pending_expressions, expression_lists, mark);
+            return ExpressionList { start: start, count: count };
+        }
+
+        StatementList finish_statements(size_t mark) {
+            auto [start, count] = flush(pending_statements, statement_lists, mark);
+            return StatementList { start: start, count: count };
+        }
+
+        IfPairList finish_if_pairs(size_t mark) {
+            auto [start, count] = flush(pending_if_pairs, if_pairs, mark);
+            return IfPairList { start: start, count: count };
+        }
+
+    private:
+        template<typename N, typename K>
+        static auto push(vector<N>& pool, N node, K kind) {
+            pool.push_back(std::move(node));
+
+            if constexpr (std::is_same_v<K, ExpressionKind>) {
+                return ExpressionRef { kind: kind, index: static_cast<uint32_t>(pool.size() - 1) };
+            } else {
+                return StatementRef { kind: kind, index: static_cast<uint32_t>(pool.size() - 1) };
+            }
+        }
+
+        // Moves pending[mark..] to the end of pool, returning where it landed and how long it is
+        template<typename N>
+        static std::tuple<uint32_t, uint32_t> flush(vector<N>& pending, vector<N>& pool, size_t mark) {
+            uint32_t start = static_cast<uint32_t>(pool.size());
+            uint32_t count = static_cast<uint32_t>(pending.size() - mark);
+
+            pool.insert(pool.end(), pending.begin() + mark, pending.end());
+            pending.resize(mark);
+
+            return {start, count};
+        }
     };
 
+    /*
+     * Visiting
+     */
+
+    inline constexpr NullLiteral null_literal {};
+
+    // Calls `f` with a reference to the node `e` points at
+    template<typename T, typename F>
+    decltype(auto) visit(const Arena<T>& arena, ExpressionRef e, F&& f) {
+        switch (e.kind) {
+            case ExpressionKind::BooleanLiteral: return f(arena.boolean_literals[e.index]);
+            case ExpressionKind::IntegerLiteral: return f(arena.integer_literals[e.index]);
+            case ExpressionKind::StringLiteral: return f(arena.string_literals[e.index]);
+            case ExpressionKind::ListLiteral: return f(arena.list_literals[e.index]);
+            case ExpressionKind::Identifier: return f(arena.identifiers[e.index]);
+            case ExpressionKind::BinaryOperation: return f(arena.binary_operations[e.index]);
+            case ExpressionKind::UnaryOperation: return f(arena.unary_operations[e.index]);
+            case ExpressionKind::Index: return f(arena.indexes[e.index]);
+            case ExpressionKind::Call: return f(arena.calls[e.index]);
+            case ExpressionKind::NullLiteral:
+            default: return f(null_literal);
+        }
+    }
+
+    template<typename T, typename F>
+    decltype(auto) visit(const Arena<T>& arena, StatementRef s, F&& f) {
+        switch (s.kind) {
+            case StatementKind::If: return f(arena.ifs[s.index]);
+            case StatementKind::While: return f(arena.whiles[s.index]);
+            case StatementKind::Return: return f(arena.returns[s.index]);
+            case StatementKind::Assignment: return f(arena.assignments[s.index]);
+            case StatementKind::VariableDeclaration: return f(arena.variable_declarations[s.index]);
+            case StatementKind::Do:
+            default: return f(arena.dos[s.index]);
+        }
+    }
+
+    /*
+     * Declarations
+     */
+
     struct Import {
         string path;
     };
@@ -212,7 +393,10 @@ namespace codegen {
     struct Function {
         string identifier;
         vector<T> parms;
-        vector<Statement<T>> body;
+        StatementList body;
+        // How many local slots a call needs, parameters included. Only known once de_bruijnify
+        // has numbered them.
+        uint64_t frame_size;
     };
 
     template<typename T>
@@ -221,23 +405,22 @@ namespace codegen {
     // AST is a template so that it can go from string to indexes without being duplicated
     template<typename T>
     struct AST {
+        Arena<T> arena;
         vector<Declaration<T>> declarations;
     };
 
     using IndexName = std::variant<string, uint64_t>;
 
     using StringAST = AST<string>;
+    using StringArena = Arena<string>;
     using StringDeclaration = Declaration<string>;
     using StringFunction = Function<string>;
-    using StringStatement = Statement<string>;
-    using StringExpression = Expression<string>;
 
     using IndexAST = AST<IndexName>;
+    using IndexArena = Arena<IndexName>;
     using IndexDeclaration = Declaration<IndexName>;
     using IndexFunction = Function<IndexName>;
-    using IndexStatement = Statement<IndexName>;
-    using IndexExpression = Expression<IndexName>;
-    
+
     StringAST to_cpp_ast(program_t*);
 }
 
@@ -0,0 +1,329 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+extern "C"
+{
+    #include "../parser/ast.h"
+    #include "../parser/parser.h"
+}
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+#include "bytecode.hpp"
+#include "instructions.hpp"
+#include "middle_end.hpp"
+#include "passes.hpp"
+
+using namespace codegen;
+
+/*
+ * Runs every phase of the compiler on its own, over a corpus of files given on the command line
+ * plus a few generated ones, and prints one JSON object per file and phase:
+ *
+ *   src/codegen/bench [-n iterations] [-j jobs] [-s scale] [file.merc...] > results.jsonl
+ *
+ * Each phase gets the previous one's output prepared ahead of time, so only the phase itself is
+ * timed. Allocations are counted the same way `--time-passes` counts them, and peak RSS is reset
+ * before every phase where the kernel lets us.
+ */
+
+// Linux only: clear_refs resets VmHWM, elsewhere the peak is just the process-wide one
+static void reset_peak_rss() {
+    FILE* clear_refs = fopen("/proc/self/clear_refs", "w");
+    if (clear_refs != NULL) {
+        fputs("5", clear_refs);
+        fclose(clear_refs);
+    }
+}
+
+static uint64_t peak_rss_kb() {
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status != NULL) {
+        char line[256];
+        while (fgets(line, sizeof(line), status) != NULL) {
+            unsigned long long kb;
+            if (sscanf(line, "VmHWM: %llu kB", &kb) == 1) {
+                fclose(status);
+                return kb;
+            }
+        }
+        fclose(status);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+struct Input {
+    string name;
+    // Padded with zeroes, the lexer reads a few bytes past the end
+    string source;
+};
+
+struct Result {
+    const char* phase;
+    const char* unit;
+    uint64_t items;
+    double seconds;
+    double cpu_seconds;
+    uint64_t allocations;
+    uint64_t bytes_allocated;
+    uint64_t peak_rss_kb;
+};
+
+// Runs `phase` `iterations` times. Whatever it returns is destroyed outside the timed region, so
+// only building it counts.
+template<typename F>
+Result measure(const char* name, const char* unit, uint64_t items, int iterations, F&& phase) {
+    Result result = Result {};
+    result.phase = name;
+    result.unit = unit;
+    result.items = items;
+
+    reset_peak_rss();
+
+    for (int i = 0; i < iterations; i++) {
+        Usage before = thread_usage();
+        auto start = std::chrono::steady_clock::now();
+
+        [[maybe_unused]] auto output = phase();
+
+        auto end = std::chrono::steady_clock::now();
+        Usage after = thread_usage();
+        result.cpu_seconds += after.cpu_seconds - before.cpu_seconds;
+        result.allocations += after.allocations - before.allocations;
+        result.bytes_allocated += after.bytes_allocated - before.bytes_allocated;
+        result.seconds += std::chrono::duration<double>(end - start).count();
+    }
+
+    result.peak_rss_kb = peak_rss_kb();
+
+    // Per iteration from here on
+    result.seconds /= iterations;
+    result.cpu_seconds /= iterations;
+    result.allocations /= iterations;
+    result.bytes_allocated /= iterations;
+
+    return result;
+}
+
+// So a C AST can be returned from a phase and freed outside the timed region like any other
+struct ParsedProgram {
+    program_t program = nullptr;
+
+    ParsedProgram() = default;
+    ParsedProgram(const ParsedProgram&) = delete;
+    ParsedProgram& operator=(const ParsedProgram&) = delete;
+
+    ParsedProgram(ParsedProgram&& other) : program(other.program) {
+        other.program = nullptr;
+    }
+
+    ParsedProgram& operator=(ParsedProgram&& other) {
+        if (this != &other) {
+            if (program) {
+                free_program(program);
+            }
+            program = other.program;
+            other.program = nullptr;
+        }
+        return *this;
+    }
+
+    ~ParsedProgram() {
+        if (program) {
+            free_program(program);
+        }
+    }
+};
+
+static std::vector<Result> run_phases(const Input& input, int iterations, size_t jobs) {
+    const char* source = input.source.c_str();
+    uint32_t len = strlen(source);
+    std::vector<Result> results;
+
+    uint64_t tokens = count_tokens(source);
+    results.push_back(measure("read_token", "tokens", tokens, iterations, [&]() {
+        return count_tokens(source);
+    }));
+
+    eh_data_t eh = {
+        .stream_start = source,
+        .overall_len = len,
+        .line_offsets = mk_offsets_list(source, len)
+    };
+
+    auto parse = [&]() {
+        const char* stream = source;
+        ParsedProgram parsed;
+        if (!parse_program(&stream, &parsed.program, eh)) {
+            fprintf(stderr, "%s doesn't parse!\n", input.name.c_str());
+            exit(-1);
+        }
+        return parsed;
+    };
+
+    ParsedProgram parsed = parse();
+    const StringAST ast = to_cpp_ast(&parsed.program);
+    uint64_t nodes = count_nodes(ast);
+
+    results.push_back(measure("parse_program", "nodes", nodes, iterations, parse));
+
+    results.push_back(measure("to_cpp_ast", "nodes", nodes, iterations, [&]() {
+        return to_cpp_ast(&parsed.program);
+    }));
+
+    const IndexAST iast = de_bruijnify(ast, jobs);
+    results.push_back(measure("de_bruijnify", "nodes", nodes, iterations, [&]() {
+        return de_bruijnify(ast, jobs);
+    }));
+
+    const Program compiled = instructionify(iast, jobs);
+    uint64_t instructions = compiled.instructions.size();
+    results.push_back(measure("instructionify", "instructions", instructions, iterations, [&]() {
+        return instructionify(iast, jobs);
+    }));
+
+    // What the glue does to hand a Program to the threaded engine
+    results.push_back(measure("glue", "instructions", instructions, iterations, [&]() {
+        return write_image(compiled, encode(compiled));
+    }));
+
+    return results;
+}
+
+static string json_string(const string& s) {
+    std::ostringstream out;
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out << escaped;
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+static void print_result(const Input& input, const Result& r, int iterations, size_t jobs) {
+    printf(
+        "{\"input\":%s,\"bytes\":%zu,\"phase\":\"%s\",\"iterations\":%d,\"jobs\":%zu,"
+        "\"seconds\":%.9f,\"cpu_seconds\":%.9f,\"unit\":\"%s\",\"items\":%llu,\"items_per_second\":%.1f,"
+        "\"allocations\":%llu,\"bytes_allocated\":%llu,\"peak_rss_kb\":%llu}\n",
+        json_string(input.name).c_str(), strlen(input.source.c_str()), r.phase, iterations, jobs,
+        r.seconds, r.cpu_seconds, r.unit, (unsigned long long)r.items,
+        r.seconds > 0 ? r.items / r.seconds : 0.0,
+        (unsigned long long)r.allocations, (unsigned long long)r.bytes_allocated,
+        (unsigned long long)r.peak_rss_kb
+    );
+}
+
+/*
+ * Generated inputs, so there's something to measure on every machine. `scale` makes each of
+ * them proportionally bigger.
+ */
+
+// Lots of small functions, like a big library
+static string synthetic_functions(int scale) {
+    std::ostringstream out;
+    out << "global total;\n";
+    for (int i = 0; i < 500 * scale; i++) {
+        out << "function f" << i << "(a, b) {\n"
+            << "    let x = a * " << i << " + b;\n"
+            << "    let xs = [x, a, b, \"f" << i << "\"];\n"
+            << "    while (x > 10) {\n"
+            << "        if (x % 2 == 0) { set x = x / 2; } else { set x = x - 1; }\n"
+            << "    }\n"
+            << "    set total = total + x;\n"
+            << "    return f" << (i + 1) % (500 * scale) << "(xs[0], x);\n"
+            << "}\n";
+    }
+    return out.str();
+}
+
+// A few functions with very long bodies and expressions, which is worst case for recursion
+static string synthetic_expressions(int scale) {
+    std::ostringstream out;
+    for (int f = 0; f < 4; f++) {
+        out << "function long" << f << "(a) {\n";
+        for (int i = 0; i < 200 * scale; i++) {
+            out << "    let v" << i << " = (a + " << i << ") * (a - " << i << ") / (" << i + 1
+                << " + a % 7) == " << i << " & !(a < " << i << ");\n";
+        }
+        out << "    return a;\n}\n";
+    }
+    return out.str();
+}
+
+// String constants and globals, which is mostly interning
+static string synthetic_strings(int scale) {
+    std::ostringstream out;
+    for (int i = 0; i < 200 * scale; i++) {
+        out << "global g" << i << ";\n";
+    }
+    out << "function strings() {\n";
+    for (int i = 0; i < 1000 * scale; i++) {
+        out << "    set g" << i % (200 * scale) << " = \"s" << i % 97 << "\" + \"t" << i << "\";\n";
+    }
+    out << "}\n";
+    return out.str();
+}
+
+static string padded(string source) {
+    source.append(4, '\0');
+    return source;
+}
+
+int main(int argc, char** argv) {
+    int iterations = 20;
+    size_t jobs = 1;
+    int scale = 1;
+    std::vector<Input> corpus;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            scale = std::max(1, atoi(argv[++i]));
+        } else {
+            std::ifstream file(argv[i], std::ios::binary);
+            if (!file) {
+                fprintf(stderr, "Could not read %s!\n", argv[i]);
+                return -1;
+            }
+
+            std::ostringstream source;
+            source << file.rdbuf();
+            corpus.push_back(Input { name: argv[i], source: padded(source.str()) });
+        }
+    }
+
+    corpus.push_back(Input { name: "synthetic:functions", source: padded(synthetic_functions(scale)) });
+    corpus.push_back(Input { name: "synthetic:expressions", source: padded(synthetic_expressions(scale)) });
+    corpus.push_back(Input { name: "synthetic:strings", source: padded(synthetic_strings(scale)) });
+
+    CountAllocations counting;
+
+    for (const Input& input : corpus) {
+        for (const Result& result : run_phases(input, iterations, jobs)) {
+            print_result(input, result, iterations, jobs);
+        }
+    }
+}
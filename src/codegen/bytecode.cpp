@@ -0,0 +1,180 @@
+#include <cstring>
+#include <limits>
+
+#include "bytecode.hpp"
+
+using namespace codegen;
+
+template<class> inline constexpr bool always_false_v = false;
+
+std::monostate panic3() {
+    *(int*)0 = 0;
+    return std::monostate {};
+}
+
+// Operands are 32 bits wide, a program that needs more than that has bigger problems
+uint32_t narrow(uint64_t value) {
+    if (value > std::numeric_limits<uint32_t>::max()) {
+        panic3();
+    }
+
+    return static_cast<uint32_t>(value);
+}
+
+// Same for the argument counts calls keep in `count`
+uint16_t narrow_count(uint64_t value) {
+    if (value > std::numeric_limits<uint16_t>::max()) {
+        panic3();
+    }
+
+    return static_cast<uint16_t>(value);
+}
+
+Op make_op(Opcode opcode, uint64_t operand = 0, uint16_t count = 0) {
+    return Op { opcode: opcode, unused: 0, count: count, operand: narrow(operand) };
+}
+
+namespace codegen {
+    Bytecode encode(const Program& program) {
+        const Instructions& ins = program.instructions;
+        Bytecode bytecode = {};
+
+        bytecode.code.reserve(ins.size());
+
+        for (const Instruction& in : ins) {
+            bytecode.code.push_back(std::visit([&](auto& in) -> Op {
+                using T = std::decay_t<decltype(in)>;
+                if constexpr (std::is_same_v<T, IImport>) {
+                    return make_op(Opcode::Import);
+                } else if constexpr (std::is_same_v<T, IFunc>) {
+                    bytecode.functions.push_back(FunctionEntry {
+                        ident: in.ident.value,
+                        parm_count: narrow(in.parm_count.value),
+                        start: narrow(bytecode.code.size() + 1),
+                        size: narrow(in.code_size),
+                        frame_size: narrow(in.frame_size),
+                        max_stack: narrow(in.max_stack),
+                    });
+
+                    return make_op(Opcode::DefineFunction, bytecode.functions.size() - 1);
+                } else if constexpr (std::is_same_v<T, IReturn>) {
+                    return make_op(Opcode::Return);
+                } else if constexpr (std::is_same_v<T, CallKnown>) {
+                    return make_op(Opcode::CallKnown, in.ident.value, narrow_count(in.arg_count.value));
+                } else if constexpr (std::is_same_v<T, CallUnknown>) {
+                    return make_op(Opcode::CallUnknown, in.arg_count.value);
+                } else if constexpr (std::is_same_v<T, CallDirect>) {
+                    return make_op(Opcode::CallDirect, in.callee.value, narrow_count(in.arg_count.value));
+                } else if constexpr (std::is_same_v<T, NullConst>) {
+                    return make_op(Opcode::NullConst);
+                } else if constexpr (std::is_same_v<T, BooleanConst>) {
+                    return make_op(Opcode::BooleanConst, in.value ? 1 : 0);
+                } else if constexpr (std::is_same_v<T, IntegerConst>) {
+                    bytecode.integers.push_back(in.value);
+                    return make_op(Opcode::IntegerConst, bytecode.integers.size() - 1);
+                } else if constexpr (std::is_same_v<T, StringConst>) {
+                    return make_op(Opcode::StringConst, in.value);
+                } else if constexpr (std::is_same_v<T, ListConst>) {
+                    return make_op(Opcode::ListConst, in.value);
+                } else if constexpr (std::is_same_v<T, GetLocal>) {
+                    return make_op(Opcode::GetLocal, in.index.value);
+                } else if constexpr (std::is_same_v<T, SetLocal>) {
+                    return make_op(Opcode::SetLocal, in.index.value);
+                } else if constexpr (std::is_same_v<T, TeeLocal>) {
+                    return make_op(Opcode::TeeLocal, in.index.value);
+                } else if constexpr (std::is_same_v<T, Drop>) {
+                    return make_op(Opcode::Drop);
+                } else if constexpr (std::is_same_v<T, Jump>) {
+                    return make_op(Opcode::Jump, in.offset.value);
+                } else if constexpr (std::is_same_v<T, JumpIfFalse>) {
+                    return make_op(Opcode::JumpIfFalse, in.offset.value);
+                } else if constexpr (std::is_same_v<T, Loop>) {
+                    return make_op(Opcode::Loop, in.offset.value);
+                } else if constexpr (std::is_same_v<T, IGlobal>) {
+                    return make_op(Opcode::Global);
+                } else if constexpr (std::is_same_v<T, GetFree>) {
+                    return make_op(Opcode::GetFree);
+                } else if constexpr (std::is_same_v<T, SetFree>) {
+                    return make_op(Opcode::SetFree);
+                } else if constexpr (std::is_same_v<T, GetGlobal>) {
+                    return make_op(Opcode::GetGlobal, in.index.value);
+                } else if constexpr (std::is_same_v<T, SetGlobal>) {
+                    return make_op(Opcode::SetGlobal, in.index.value);
+                } else if constexpr (std::is_same_v<T, IAdd>) {
+                    return make_op(Opcode::Add);
+                } else if constexpr (std::is_same_v<T, ISub>) {
+                    return make_op(Opcode::Sub);
+                } else if constexpr (std::is_same_v<T, IMul>) {
+                    return make_op(Opcode::Mul);
+                } else if constexpr (std::is_same_v<T, IDiv>) {
+                    return make_op(Opcode::Div);
+                } else if constexpr (std::is_same_v<T, IMod>) {
+                    return make_op(Opcode::Mod);
+                } else if constexpr (std::is_same_v<T, IEq>) {
+                    return make_op(Opcode::Eq);
+                } else if constexpr (std::is_same_v<T, INe>) {
+                    return make_op(Opcode::Ne);
+                } else if constexpr (std::is_same_v<T, ILt>) {
+                    return make_op(Opcode::Lt);
+                } else if constexpr (std::is_same_v<T, ILe>) {
+                    return make_op(Opcode::Le);
+                } else if constexpr (std::is_same_v<T, IGt>) {
+                    return make_op(Opcode::Gt);
+                } else if constexpr (std::is_same_v<T, IGe>) {
+                    return make_op(Opcode::Ge);
+                } else if constexpr (std::is_same_v<T, IAnd>) {
+                    return make_op(Opcode::And);
+                } else if constexpr (std::is_same_v<T, IOr>) {
+                    return make_op(Opcode::Or);
+                } else if constexpr (std::is_same_v<T, INegate>) {
+                    return make_op(Opcode::Negate);
+                } else if constexpr (std::is_same_v<T, INot>) {
+                    return make_op(Opcode::Not);
+                } else if constexpr (std::is_same_v<T, IIndex>) {
+                    return make_op(Opcode::Index);
+                } else if constexpr (std::is_same_v<T, IIndexSet>) {
+                    return make_op(Opcode::IndexSet);
+                } else {
+                    static_assert(always_false_v<T>, "non-exhaustive visitor!");
+                }
+            }, in));
+        }
+
+        return bytecode;
+    }
+
+    string write_image(const Program& program, const Bytecode& bytecode) {
+        string image(sizeof(ImageHeader), '\0');
+
+        auto append = [&](const void* data, size_t element_size, size_t count) -> ImageSection {
+            image.resize((image.size() + 7) / 8 * 8, '\0');
+            ImageSection section = ImageSection { offset: image.size(), count: count };
+            image.append(static_cast<const char*>(data), element_size * count);
+            return section;
+        };
+
+        vector<StringSpan> spans = {};
+        string string_bytes = {};
+
+        for (StringId id = 0; id < program.strings.size(); id++) {
+            const string& s = program.strings.get(id);
+            spans.push_back(StringSpan { offset: narrow(string_bytes.size()), len: narrow(s.size()) });
+            string_bytes += s;
+        }
+
+        ImageHeader header = {};
+        std::memcpy(header.magic, image_magic, sizeof(header.magic));
+        header.version = image_version;
+        header.byte_order = image_byte_order;
+        header.code = append(bytecode.code.data(), sizeof(Op), bytecode.code.size());
+        header.integers = append(bytecode.integers.data(), sizeof(int64_t), bytecode.integers.size());
+        header.functions = append(bytecode.functions.data(), sizeof(FunctionEntry), bytecode.functions.size());
+        header.globals = append(program.globals.data(), sizeof(StringId), program.globals.size());
+        header.strings = append(spans.data(), sizeof(StringSpan), spans.size());
+        header.string_bytes = append(string_bytes.data(), 1, string_bytes.size());
+
+        std::memcpy(image.data(), &header, sizeof(header));
+
+        return image;
+    }
+}
@@ -0,0 +1,144 @@
+#ifndef BYTECODE_CODEGEN
+#define BYTECODE_CODEGEN
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "instructions.hpp"
+#include "interner.hpp"
+
+namespace codegen {
+    /*
+     * The runtime's threaded engine doesn't want a variant per instruction, it wants something it
+     * can index with a program counter and dispatch on with one load. So every Instruction becomes
+     * exactly one 8 byte Op, at the same position it had in Program::instructions. Operands that
+     * don't fit in 32 bits live in side tables next to the code.
+     */
+
+    enum class Opcode : uint8_t {
+        Import,
+        // operand is an index into Bytecode::functions
+        DefineFunction,
+        Return,
+        // operand is the callee's StringId, count is the argument count
+        CallKnown,
+        // operand is the argument count
+        CallUnknown,
+        NullConst,
+        // operand is 0 or 1
+        BooleanConst,
+        // operand is an index into Bytecode::integers
+        IntegerConst,
+        // operand is a StringId
+        StringConst,
+        // operand is the element count
+        ListConst,
+        GetLocal,
+        SetLocal,
+        Drop,
+        // operand is the distance to the target, forwards for Jump(IfFalse) and backwards for Loop
+        Jump,
+        JumpIfFalse,
+        Loop,
+        Global,
+        GetFree,
+        SetFree,
+        // operand is a GlobalIndex
+        GetGlobal,
+        SetGlobal,
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Mod,
+        Eq,
+        Ne,
+        Lt,
+        Le,
+        Gt,
+        Ge,
+        And,
+        Or,
+        Negate,
+        Not,
+        Index,
+        IndexSet,
+        TeeLocal,
+        // operand is the callee's GlobalIndex, count is the argument count
+        CallDirect,
+    };
+
+    struct Op {
+        Opcode opcode;
+        uint8_t unused;
+        uint16_t count;
+        uint32_t operand;
+    };
+
+    static_assert(sizeof(Op) == 8, "Ops have to stay one word wide");
+
+    // The body of a function is `size` Ops starting at `start`, right after its DefineFunction.
+    // A call to it needs `frame_size` locals, and at most `max_stack` values on the stack.
+    struct FunctionEntry {
+        StringId ident;
+        uint32_t parm_count;
+        uint32_t start;
+        uint32_t size;
+        uint32_t frame_size;
+        uint32_t max_stack;
+    };
+
+    struct Bytecode {
+        vector<Op> code;
+        vector<int64_t> integers;
+        vector<FunctionEntry> functions;
+    };
+
+    Bytecode encode(const Program&);
+
+    /*
+     * Images
+     *
+     * A Program and its Bytecode written out as one blob, which the runtime can map and run in
+     * place. Everything is in the writer's byte order, and every section starts 8 byte aligned
+     * relative to the start of the image.
+     */
+
+    inline constexpr char image_magic[8] = { 'M', 'E', 'R', 'C', 'B', 'Y', 'T', 'E' };
+
+    // Bump this whenever the layout of anything below, Op or Opcode changes
+    inline constexpr uint32_t image_version = 7;
+
+    // Reads back as something else on a machine with the other byte order
+    inline constexpr uint32_t image_byte_order = 0x01020304;
+
+    // `count` elements starting `offset` bytes into the image
+    struct ImageSection {
+        uint64_t offset;
+        uint64_t count;
+    };
+
+    // Where one string lives in the `string_bytes` section
+    struct StringSpan {
+        uint32_t offset;
+        uint32_t len;
+    };
+
+    struct ImageHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        ImageSection code;          // Op
+        ImageSection integers;      // int64_t
+        ImageSection functions;     // FunctionEntry
+        ImageSection globals;       // StringId, one per GlobalIndex
+        ImageSection strings;       // StringSpan, one per StringId
+        ImageSection string_bytes;  // char
+    };
+
+    string write_image(const Program&, const Bytecode&);
+}
+
+#endif
@@ -0,0 +1,751 @@
+#include <stdint.h>
+
+#include <algorithm>
+#include <optional>
+#include <variant>
+
+#include "fold.hpp"
+
+using namespace codegen;
+
+template<class> inline constexpr bool always_false_v = false;
+
+/*
+ * Values the compiler can know ahead of time: runtime::value::Value, minus functions. Every
+ * operation below is a transcription of its namesake in value.rs or operators.rs, and gives up
+ * (returns nothing) wherever the runtime would panic or the answer depends on how Rust was built,
+ * like integer overflow. Those are left for the runtime to get wrong the way it always has.
+ */
+
+struct Constant;
+
+using ConstantList = vector<Constant>;
+
+struct Constant {
+    std::variant<std::monostate, bool, int64_t, string, ConstantList> value;
+};
+
+using Folded = std::optional<Constant>;
+
+// Bigger results are cheaper to build at runtime than to carry around in the program
+static const size_t max_folded_size = 4096;
+
+static size_t folded_size(const Constant& c) {
+    if (auto s = std::get_if<string>(&c.value); s) {
+        return s->size();
+    } else if (auto l = std::get_if<ConstantList>(&c.value); l) {
+        size_t size = 1;
+        for (const Constant& e : *l) {
+            size += folded_size(e);
+        }
+
+        return size;
+    }
+
+    return 1;
+}
+
+// The engines either reject strings that aren't UTF-8 or mangle them on the way in, so those are
+// never treated as constants. As strict as Rust's from_utf8: no overlong forms, surrogates or
+// anything past U+10FFFF.
+static bool valid_utf8(const string& s) {
+    size_t i = 0;
+    while (i < s.size()) {
+        unsigned char c = s[i];
+        size_t length = c < 0x80 ? 1 : c < 0xc2 ? 0 : c < 0xe0 ? 2 : c < 0xf0 ? 3 : c < 0xf5 ? 4 : 0;
+
+        if (length == 0 || i + length > s.size()) {
+            return false;
+        }
+
+        for (size_t j = 1; j < length; j++) {
+            if (((unsigned char)s[i + j] >> 6) != 0x2) {
+                return false;
+            }
+        }
+
+        unsigned char second = s[i + 1];
+        if ((c == 0xe0 && second < 0xa0) || (c == 0xed && second >= 0xa0)
+            || (c == 0xf0 && second < 0x90) || (c == 0xf4 && second >= 0x90)) {
+            return false;
+        }
+
+        i += length;
+    }
+
+    return true;
+}
+
+static bool truthy(const Constant& c) {
+    return std::visit([](auto& v) -> bool {
+        using T = std::decay_t<decltype(v)>;
+        if constexpr (std::is_same_v<T, std::monostate>) {
+            return false;
+        } else if constexpr (std::is_same_v<T, bool>) {
+            return v;
+        } else if constexpr (std::is_same_v<T, int64_t>) {
+            return v != 0;
+        } else if constexpr (std::is_same_v<T, string>) {
+            return !v.empty();
+        } else if constexpr (std::is_same_v<T, ConstantList>) {
+            return !v.empty();
+        } else {
+            static_assert(always_false_v<T>, "non-exhaustive visitor!");
+        }
+    }, c.value);
+}
+
+// Only for what `add` formats, which is never a list
+static string to_string(const Constant& c) {
+    if (auto b = std::get_if<bool>(&c.value); b) {
+        return *b ? "true" : "false";
+    } else if (auto i = std::get_if<int64_t>(&c.value); i) {
+        return std::to_string(*i);
+    } else if (auto s = std::get_if<string>(&c.value); s) {
+        return *s;
+    }
+
+    return "null";
+}
+
+template<typename T>
+static std::optional<int> three_way(const T& a, const T& b) {
+    return a < b ? -1 : b < a ? 1 : 0;
+}
+
+// Value::compare, with Ordering as -1, 0 and 1
+static std::optional<int> compare(const Constant& a, const Constant& b) {
+    const auto& x = a.value;
+    const auto& y = b.value;
+
+    if (x.index() == y.index()) {
+        if (std::holds_alternative<std::monostate>(x)) {
+            return 0;
+        } else if (auto l = std::get_if<ConstantList>(&x); l) {
+            const ConstantList& m = std::get<ConstantList>(y);
+            for (size_t i = 0; i < std::min(l->size(), m.size()); i++) {
+                std::optional<int> ordering = compare((*l)[i], m[i]);
+                if (ordering != 0) {
+                    return ordering;
+                }
+            }
+
+            return three_way(l->size(), m.size());
+        } else if (auto s = std::get_if<string>(&x); s) {
+            // Same as comparing bytes, since char_traits<char> compares them unsigned
+            int ordering = s->compare(std::get<string>(y));
+            return ordering < 0 ? -1 : ordering > 0 ? 1 : 0;
+        } else if (auto i = std::get_if<int64_t>(&x); i) {
+            return three_way(*i, std::get<int64_t>(y));
+        } else {
+            return three_way(std::get<bool>(x), std::get<bool>(y));
+        }
+    }
+
+    auto i = std::get_if<int64_t>(&x);
+    auto j = std::get_if<int64_t>(&y);
+    auto s = std::get_if<string>(&x);
+    auto t = std::get_if<string>(&y);
+    auto p = std::get_if<bool>(&x);
+    auto q = std::get_if<bool>(&y);
+
+    if (i && t) {
+        return compare(Constant { std::to_string(*i) }, b);
+    } else if (s && j) {
+        return compare(a, Constant { std::to_string(*j) });
+    } else if (p && j) {
+        return three_way((int64_t)*p, *j);
+    } else if (i && q) {
+        return three_way(*i, (int64_t)*q);
+    } else if (p && t) {
+        return three_way(*p, t->empty());
+    } else if (s && q) {
+        return three_way(s->empty(), *q);
+    }
+
+    // Null or a list against anything else
+    return std::nullopt;
+}
+
+static Folded negate(const Constant& c) {
+    return std::visit([](auto& v) -> Folded {
+        using T = std::decay_t<decltype(v)>;
+        if constexpr (std::is_same_v<T, std::monostate>) {
+            return Constant {};
+        } else if constexpr (std::is_same_v<T, bool>) {
+            return Constant { !v };
+        } else if constexpr (std::is_same_v<T, int64_t>) {
+            if (v == INT64_MIN) {
+                return std::nullopt;
+            }
+
+            return Constant { -v };
+        } else if constexpr (std::is_same_v<T, string>) {
+            // Reversed by characters, not bytes
+            string reversed;
+            reversed.reserve(v.size());
+
+            size_t end = v.size();
+            while (end > 0) {
+                size_t start = end - 1;
+                while (start > 0 && ((unsigned char)v[start] >> 6) == 0x2) {
+                    start--;
+                }
+
+                reversed.append(v, start, end - start);
+                end = start;
+            }
+
+            return Constant { reversed };
+        } else if constexpr (std::is_same_v<T, ConstantList>) {
+            ConstantList reversed;
+            for (auto it = v.rbegin(); it != v.rend(); ++it) {
+                Folded e = negate(*it);
+                if (!e) {
+                    return std::nullopt;
+                }
+
+                reversed.push_back(*e);
+            }
+
+            return Constant { reversed };
+        } else {
+            static_assert(always_false_v<T>, "non-exhaustive visitor!");
+        }
+    }, c.value);
+}
+
+static Folded add(const Constant& a, const Constant& b) {
+    const auto& x = a.value;
+    const auto& y = b.value;
+
+    auto l = std::get_if<ConstantList>(&x);
+    auto m = std::get_if<ConstantList>(&y);
+
+    if (l || m) {
+        ConstantList joined = l ? *l : *m;
+        if (l && m) {
+            joined.insert(joined.end(), m->begin(), m->end());
+        } else {
+            // Whichever side isn't a list goes on the end, even when it's the left one
+            joined.push_back(l ? b : a);
+        }
+
+        return Constant { joined };
+    }
+
+    if (std::holds_alternative<string>(x) || std::holds_alternative<string>(y)) {
+        return Constant { to_string(a) + to_string(b) };
+    }
+
+    auto i = std::get_if<int64_t>(&x);
+    auto j = std::get_if<int64_t>(&y);
+    auto p = std::get_if<bool>(&x);
+    auto q = std::get_if<bool>(&y);
+
+    if ((i || p) && (j || q)) {
+        int64_t sum;
+        if (__builtin_add_overflow(i ? *i : (int64_t)*p, j ? *j : (int64_t)*q, &sum)) {
+            return std::nullopt;
+        }
+
+        return Constant { sum };
+    }
+
+    // Null plus null, an integer or a boolean is whichever one isn't null
+    return p || i ? a : b;
+}
+
+static Folded subtract(const Constant& a, const Constant& b) {
+    auto i = std::get_if<int64_t>(&a.value);
+    auto j = std::get_if<int64_t>(&b.value);
+    auto p = std::get_if<bool>(&a.value);
+    auto q = std::get_if<bool>(&b.value);
+
+    // Unlike add, two booleans don't subtract
+    if ((i && j) || (i && q) || (p && j)) {
+        int64_t difference;
+        if (__builtin_sub_overflow(i ? *i : (int64_t)*p, j ? *j : (int64_t)*q, &difference)) {
+            return std::nullopt;
+        }
+
+        return Constant { difference };
+    }
+
+    return Constant {};
+}
+
+static Folded multiply(const Constant& a, const Constant& b) {
+    auto i = std::get_if<int64_t>(&a.value);
+    auto j = std::get_if<int64_t>(&b.value);
+    auto s = std::get_if<string>(&a.value);
+    auto t = std::get_if<string>(&b.value);
+    auto l = std::get_if<ConstantList>(&a.value);
+
+    if (i && j) {
+        int64_t product;
+        if (__builtin_mul_overflow(*i, *j, &product)) {
+            return std::nullopt;
+        }
+
+        return Constant { product };
+    } else if ((i && t) || (s && j)) {
+        const string& repeated = s ? *s : *t;
+        int64_t count = std::max<int64_t>(i ? *i : *j, 0);
+
+        if (!repeated.empty() && count > (int64_t)(max_folded_size / repeated.size())) {
+            return std::nullopt;
+        }
+
+        string out;
+        for (int64_t k = 0; k < count; k++) {
+            out += repeated;
+        }
+
+        return Constant { out };
+    } else if (l && j) {
+        // The runtime repeats the elements themselves, so a list inside would end up shared
+        // between the copies, which a literal can't express
+        for (const Constant& e : *l) {
+            if (std::holds_alternative<ConstantList>(e.value)) {
+                return std::nullopt;
+            }
+        }
+
+        int64_t times = std::max<int64_t>(*j, 1);
+        if (!l->empty() && times > (int64_t)(max_folded_size / l->size())) {
+            return std::nullopt;
+        }
+
+        ConstantList out;
+        for (int64_t k = 0; k < times; k++) {
+            out.insert(out.end(), l->begin(), l->end());
+        }
+
+        return Constant { out };
+    }
+
+    return Constant {};
+}
+
+static Folded divide(const Constant& a, const Constant& b, bool modulo) {
+    auto i = std::get_if<int64_t>(&a.value);
+    auto j = std::get_if<int64_t>(&b.value);
+
+    if (!i || !j) {
+        return Constant {};
+    }
+
+    if (*j == 0) {
+        return Constant { string(modulo ? "oopsie ><" : "∞") };
+    }
+
+    // Overflows, which Rust panics on even in release
+    if (*i == INT64_MIN && *j == -1) {
+        return std::nullopt;
+    }
+
+    return Constant { modulo ? *i % *j : *i / *j };
+}
+
+// operators.rs's `index`, but only where it can't panic or leave nothing on the stack
+static Folded index(const Constant& a, const Constant& b) {
+    int64_t idx;
+    if (auto i = std::get_if<int64_t>(&b.value); i) {
+        idx = *i;
+    } else if (auto p = std::get_if<bool>(&b.value); p) {
+        idx = *p;
+    } else {
+        return std::nullopt;
+    }
+
+    if (auto l = std::get_if<ConstantList>(&a.value); l) {
+        if (idx < 0 || (uint64_t)idx >= l->size()) {
+            return std::nullopt;
+        }
+
+        return (*l)[idx];
+    } else if (auto s = std::get_if<string>(&a.value); s) {
+        // A byte, and only where that byte is a whole character
+        if (idx < 0 || (uint64_t)idx >= s->size() || (unsigned char)(*s)[idx] >= 0x80) {
+            return std::nullopt;
+        }
+
+        return Constant { s->substr(idx, 1) };
+    }
+
+    return std::nullopt;
+}
+
+static Folded binary(BinaryFlavor flavor, const Constant& a, const Constant& b) {
+    std::optional<int> ordering = compare(a, b);
+
+    switch (flavor) {
+    case BinaryFlavor::Equal:
+        return Constant { ordering == 0 };
+    case BinaryFlavor::NotEqual:
+        return Constant { ordering != 0 };
+    case BinaryFlavor::GreaterThan:
+        return Constant { ordering == 1 };
+    case BinaryFlavor::GreaterThanOrEqual:
+        return Constant { ordering == 1 || ordering == 0 };
+    case BinaryFlavor::LessThan:
+        return Constant { ordering == -1 };
+    case BinaryFlavor::LessThanOrEqual:
+        return Constant { ordering == -1 || ordering == 0 };
+    case BinaryFlavor::And:
+        return Constant { truthy(a) && truthy(b) };
+    case BinaryFlavor::Or:
+        return Constant { truthy(a) || truthy(b) };
+    case BinaryFlavor::Addition:
+        return add(a, b);
+    case BinaryFlavor::Subtraction:
+        return subtract(a, b);
+    case BinaryFlavor::Multiplication:
+        return multiply(a, b);
+    case BinaryFlavor::Division:
+        return divide(a, b, false);
+    case BinaryFlavor::ModulousOrRemainder:
+        return divide(a, b, true);
+    default:
+        return std::nullopt;
+    }
+}
+
+// Works on the arena in place. Pools grow as folded values get turned back into nodes, so nodes
+// are always copied out before recursing and written back by index after.
+class Folder {
+public:
+    explicit Folder(IndexArena& arena) : arena(arena) {}
+
+    ExpressionRef fold_expression(ExpressionRef e) {
+        switch (e.kind) {
+        case ExpressionKind::ListLiteral: {
+            ExpressionList elements = arena.list_literals[e.index].value;
+            fold_expressions(elements);
+            return e;
+        }
+        case ExpressionKind::BinaryOperation: {
+            BinaryOperation b = arena.binary_operations[e.index];
+            b.left = fold_expression(b.left);
+            b.right = fold_expression(b.right);
+            arena.binary_operations[e.index] = b;
+
+            return fold_binary(e, b);
+        }
+        case ExpressionKind::UnaryOperation: {
+            UnaryOperation u = arena.unary_operations[e.index];
+            u.content = fold_expression(u.content);
+            arena.unary_operations[e.index] = u;
+
+            return fold_unary(e, u);
+        }
+        case ExpressionKind::Index: {
+            Index i = arena.indexes[e.index];
+            i.list = fold_expression(i.list);
+            i.number = fold_expression(i.number);
+            arena.indexes[e.index] = i;
+
+            Folded list = constant(i.list);
+            Folded number = constant(i.number);
+            if (list && number) {
+                return replace(e, index(*list, *number));
+            }
+
+            return e;
+        }
+        case ExpressionKind::Call: {
+            Call c = arena.calls[e.index];
+            fold_expressions(c.args);
+            c.function = fold_expression(c.function);
+            arena.calls[e.index] = c;
+
+            return e;
+        }
+        default:
+            return e;
+        }
+    }
+
+    void fold_statements(StatementList s) {
+        for (uint32_t i = s.start; i < s.start + s.count; i++) {
+            arena.statement_lists[i] = fold_statement(arena.statement_lists[i]);
+        }
+    }
+
+private:
+    IndexArena& arena;
+
+    void fold_expressions(ExpressionList l) {
+        for (uint32_t i = l.start; i < l.start + l.count; i++) {
+            arena.expression_lists[i] = fold_expression(arena.expression_lists[i]);
+        }
+    }
+
+    StatementRef fold_statement(StatementRef s) {
+        switch (s.kind) {
+        case StatementKind::If:
+            fold_if(s.index);
+            return s;
+        case StatementKind::While: {
+            While w = arena.whiles[s.index];
+            w.condition = fold_expression(w.condition);
+            fold_statements(w.body);
+            arena.whiles[s.index] = w;
+
+            // An if with nowhere to go compiles to nothing at all
+            if (Folded c = constant(w.condition); c && !truthy(*c)) {
+                return arena.add(If { if_pairs: IfPairList { start: 0, count: 0 }, else_body: std::nullopt });
+            }
+
+            return s;
+        }
+        case StatementKind::Return:
+            arena.returns[s.index].content = fold_expression(arena.returns[s.index].content);
+            return s;
+        case StatementKind::Assignment: {
+            Assignment<IndexName> a = arena.assignments[s.index];
+            fold_expressions(a.indexes);
+            a.content = fold_expression(a.content);
+            arena.assignments[s.index] = a;
+            return s;
+        }
+        case StatementKind::VariableDeclaration: {
+            ExpressionRef content = fold_expression(arena.variable_declarations[s.index].content);
+            arena.variable_declarations[s.index].content = content;
+            return s;
+        }
+        case StatementKind::Do:
+        default:
+            arena.dos[s.index].content = fold_expression(arena.dos[s.index].content);
+            return s;
+        }
+    }
+
+    // Pairs whose condition is always false are dropped, and the first one that's always true
+    // becomes the else, since nothing after it can run
+    void fold_if(uint32_t at) {
+        If i = arena.ifs[at];
+        bool changed = false;
+        bool cut = false;
+        size_t mark = arena.pending_if_pairs.size();
+
+        for (uint32_t p = i.if_pairs.start; p < i.if_pairs.start + i.if_pairs.count; p++) {
+            IfPair pair = arena.if_pairs[p];
+            pair.condition = fold_expression(pair.condition);
+            fold_statements(pair.body);
+            arena.if_pairs[p] = pair;
+
+            Folded c = constant(pair.condition);
+            if (!c) {
+                arena.pending_if_pairs.push_back(pair);
+            } else if (!truthy(*c)) {
+                changed = true;
+            } else {
+                changed = true;
+                cut = true;
+                i.else_body = pair.body;
+                break;
+            }
+        }
+
+        if (auto body = i.else_body; body && !cut) {
+            fold_statements(*body);
+        }
+
+        if (changed) {
+            i.if_pairs = arena.finish_if_pairs(mark);
+        } else {
+            arena.pending_if_pairs.resize(mark);
+        }
+
+        arena.ifs[at] = i;
+    }
+
+    // Literals, and lists of them
+    Folded constant(ExpressionRef e) const {
+        switch (e.kind) {
+        case ExpressionKind::NullLiteral:
+            return Constant {};
+        case ExpressionKind::BooleanLiteral:
+            return Constant { arena.boolean_literals[e.index].value };
+        case ExpressionKind::IntegerLiteral:
+            return Constant { arena.integer_literals[e.index].value };
+        case ExpressionKind::StringLiteral: {
+            const string& s = arena.string_literals[e.index].value;
+            if (!valid_utf8(s)) {
+                return std::nullopt;
+            }
+
+            return Constant { s };
+        }
+        case ExpressionKind::ListLiteral: {
+            ConstantList elements;
+            for (ExpressionRef d : arena.expressions(arena.list_literals[e.index].value)) {
+                Folded c = constant(d);
+                if (!c) {
+                    return std::nullopt;
+                }
+
+                elements.push_back(*c);
+            }
+
+            return Constant { elements };
+        }
+        default:
+            return std::nullopt;
+        }
+    }
+
+    // Turns a value back into nodes. A list becomes a literal, which builds a fresh list every
+    // time it's evaluated, same as the operation it replaces.
+    ExpressionRef materialize(const Constant& c) {
+        return std::visit([&](auto& v) -> ExpressionRef {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, std::monostate>) {
+                return arena.add(null_literal);
+            } else if constexpr (std::is_same_v<T, bool>) {
+                return arena.add(BooleanLiteral { value: v });
+            } else if constexpr (std::is_same_v<T, int64_t>) {
+                return arena.add(IntegerLiteral { value: v });
+            } else if constexpr (std::is_same_v<T, string>) {
+                return arena.add(StringLiteral { value: v });
+            } else if constexpr (std::is_same_v<T, ConstantList>) {
+                size_t mark = arena.pending_expressions.size();
+                for (const Constant& e : v) {
+                    ExpressionRef element = materialize(e);
+                    arena.pending_expressions.push_back(element);
+                }
+
+                return arena.add(ListLiteral { value: arena.finish_expressions(mark) });
+            } else {
+                static_assert(always_false_v<T>, "non-exhaustive visitor!");
+            }
+        }, c.value);
+    }
+
+    // `e`, unless there's a result to replace it with
+    ExpressionRef replace(ExpressionRef e, const Folded& result) {
+        if (!result || folded_size(*result) > max_folded_size) {
+            return e;
+        }
+
+        return materialize(*result);
+    }
+
+    ExpressionRef fold_binary(ExpressionRef e, const BinaryOperation& b) {
+        Folded left = constant(b.left);
+        Folded right = constant(b.right);
+        if (left && right) {
+            return replace(e, binary(b.flavor, *left, *right));
+        }
+
+        // `&` and `|` evaluate both sides and then only look at their truthiness, so one known
+        // side either decides the answer or hands it to the other
+        if (b.flavor != BinaryFlavor::And && b.flavor != BinaryFlavor::Or) {
+            return e;
+        }
+
+        bool deciding = b.flavor == BinaryFlavor::Or;
+        for (auto [known, other] : { std::pair { b.left, b.right }, std::pair { b.right, b.left } }) {
+            Folded c = constant(known);
+            if (!c) {
+                continue;
+            }
+
+            if (truthy(*c) == deciding && pure(other)) {
+                return arena.add(BooleanLiteral { value: deciding });
+            } else if (truthy(*c) != deciding && boolean(other)) {
+                return other;
+            }
+        }
+
+        return e;
+    }
+
+    // `!` and unary `-` are the same operation at runtime
+    ExpressionRef fold_unary(ExpressionRef e, const UnaryOperation& u) {
+        if (Folded content = constant(u.content); content) {
+            return replace(e, negate(*content));
+        }
+
+        if (u.content.kind == ExpressionKind::UnaryOperation) {
+            // Negating a boolean twice gets it back, unlike a list which would be copied
+            ExpressionRef inner = arena.unary_operations[u.content.index].content;
+            if (boolean(inner)) {
+                return inner;
+            }
+        } else if (u.content.kind == ExpressionKind::BinaryOperation) {
+            // != is exactly the negation of ==, even for things that don't compare. The node only
+            // has this one parent, so it can be flipped where it is.
+            BinaryOperation& inner = arena.binary_operations[u.content.index];
+            if (inner.flavor == BinaryFlavor::Equal || inner.flavor == BinaryFlavor::NotEqual) {
+                inner.flavor = inner.flavor == BinaryFlavor::Equal ? BinaryFlavor::NotEqual : BinaryFlavor::Equal;
+                return u.content;
+            }
+        }
+
+        return e;
+    }
+
+    // Always evaluates to a boolean
+    bool boolean(ExpressionRef e) const {
+        switch (e.kind) {
+        case ExpressionKind::BooleanLiteral:
+            return true;
+        case ExpressionKind::BinaryOperation:
+            switch (arena.binary_operations[e.index].flavor) {
+            case BinaryFlavor::Equal:
+            case BinaryFlavor::NotEqual:
+            case BinaryFlavor::GreaterThan:
+            case BinaryFlavor::GreaterThanOrEqual:
+            case BinaryFlavor::LessThan:
+            case BinaryFlavor::LessThanOrEqual:
+            case BinaryFlavor::And:
+            case BinaryFlavor::Or:
+                return true;
+            default:
+                return false;
+            }
+        case ExpressionKind::UnaryOperation:
+            return boolean(arena.unary_operations[e.index].content);
+        default:
+            return false;
+        }
+    }
+
+    // Can be left out without anything noticing
+    bool pure(ExpressionRef e) const {
+        switch (e.kind) {
+        case ExpressionKind::NullLiteral:
+        case ExpressionKind::BooleanLiteral:
+        case ExpressionKind::IntegerLiteral:
+        case ExpressionKind::StringLiteral:
+            return true;
+        case ExpressionKind::Identifier:
+            return std::holds_alternative<uint64_t>(arena.identifiers[e.index].value);
+        case ExpressionKind::ListLiteral:
+            for (ExpressionRef d : arena.expressions(arena.list_literals[e.index].value)) {
+                if (!pure(d)) {
+                    return false;
+                }
+            }
+
+            return true;
+        default:
+            return false;
+        }
+    }
+};
+
+namespace codegen {
+    void fold_constants(IndexAST& ast) {
+        Folder folder(ast.arena);
+
+        for (const IndexDeclaration& d : ast.declarations) {
+            if (auto f = std::get_if<IndexFunction>(&d); f) {
+                folder.fold_statements(f->body);
+            }
+        }
+    }
+}
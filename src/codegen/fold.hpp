@@ -0,0 +1,13 @@
+#ifndef FOLD_CODEGEN
+#define FOLD_CODEGEN
+
+#include "ast.hpp"
+
+namespace codegen {
+    // Evaluates whatever can be evaluated ahead of time, with exactly the semantics the runtime's
+    // value.rs would have given it, and drops branches that can never be taken. Runs between
+    // de_bruijnify and instructionify at -O1 and up.
+    void fold_constants(IndexAST& ast);
+}
+
+#endif
@@ -3,8 +3,10 @@
 #include <optional>
 #include <sstream>
 #include <tuple>
+#include <unordered_map>
 
 #include "instructions.hpp"
+#include "parallel.hpp"
 
 using namespace codegen;
 
@@ -15,88 +17,84 @@ std::monostate panic2() {
     return std::monostate {};
 }
 
-string stringify_binop(BinaryFlavor b) {
+Instruction binop_instruction(BinaryFlavor b) {
     switch (b) {
     case BinaryFlavor::Equal:
-        return "~==";
+        return IEq {};
         break;
 
     case BinaryFlavor::NotEqual:
-        return "~!=";
+        return INe {};
         break;
 
     case BinaryFlavor::GreaterThan:
-        return "~>";
+        return IGt {};
         break;
 
     case BinaryFlavor::GreaterThanOrEqual:
-        return "~>=";
+        return IGe {};
         break;
 
     case BinaryFlavor::LessThan:
-        return "~<";
+        return ILt {};
         break;
 
     case BinaryFlavor::LessThanOrEqual:
-        return "~<=";
+        return ILe {};
         break;
 
     case BinaryFlavor::And:
-        return "~&&";
+        return IAnd {};
         break;
 
     case BinaryFlavor::Or:
-        return "~||";
+        return IOr {};
         break;
 
     case BinaryFlavor::Addition:
-        return "~+";
+        return IAdd {};
         break;
 
     case BinaryFlavor::Subtraction:
-        return "~-";
+        return ISub {};
         break;
 
     case BinaryFlavor::Multiplication:
-        return "~*";
+        return IMul {};
         break;
 
     case BinaryFlavor::Division:
-        return "~/";
+        return IDiv {};
         break;
 
     case BinaryFlavor::ModulousOrRemainder:
-        return "~%";
+        return IMod {};
         break;
     
     default:
         panic2();
-        return "~!!!";
+        return NullConst {};
         break;
     }
 }
 
-string stringify_unop(UnaryFlavor b) {
+Instruction unop_instruction(UnaryFlavor b) {
     switch (b) {
     case UnaryFlavor::Negate:
-        return "#-";
+        return INegate {};
         break;
 
     case UnaryFlavor::Not:
-        return "#!";
+        return INot {};
         break;
     
     default:
         panic2();
-        return "#!!!";
+        return NullConst {};
         break;
     }
 }
 
-IIdentifier make_iident(const string& s) {
-    return IIdentifier { value: new string(s) };
-}
-
 Arity make_arity(uint64_t a) {
     return Arity { value: a };
 }
@@ -105,302 +103,351 @@ LocalIndex make_index(uint64_t i) {
     return LocalIndex { value: i };
 }
 
-Instructions insify_expression(const IndexExpression& e) {
-    return std::visit([](auto& e) -> Instructions {
-        using T = std::decay_t<decltype(e)>;
-        if constexpr (std::is_same_v<T, NullLiteral>) {
-            return {NullConst {}};
-        } else if constexpr (std::is_same_v<T, BooleanLiteral>) {
-            return {BooleanConst { value: e.value }};
-        } else if constexpr (std::is_same_v<T, IntegerLiteral>) {
-            return {IntegerConst { value: e.value }};
-        } else if constexpr (std::is_same_v<T, StringLiteral>) {
-            string* copyVal = new string(e.value);
-            return {StringConst { value: copyVal }};
-        } else if constexpr (std::is_same_v<T, ListLiteral<IndexName>>) {
-            Instructions ins  = {};
-            
-            for (IndexExpression expr : e.value) {
-                Instructions expr_ins = insify_expression(expr);
-                ins.insert(ins.end(), expr_ins.begin(), expr_ins.end());
-            }
+// Lowers an IndexAST by appending straight onto one output buffer, so nothing is built up in
+// temporary vectors and spliced back together on the way out of the recursion
+class Emitter {
+public:
+    Emitter(const IndexArena& arena, Program& program)
+        : arena(arena), strings(program.strings), globals(program.globals), out(program.instructions) {}
+
+    void insify_expression(ExpressionRef e) {
+        visit(arena, e, [&](auto& e) {
+            using T = std::decay_t<decltype(e)>;
+            if constexpr (std::is_same_v<T, NullLiteral>) {
+                out.push_back(NullConst {});
+            } else if constexpr (std::is_same_v<T, BooleanLiteral>) {
+                out.push_back(BooleanConst { value: e.value });
+            } else if constexpr (std::is_same_v<T, IntegerLiteral>) {
+                out.push_back(IntegerConst { value: e.value });
+            } else if constexpr (std::is_same_v<T, StringLiteral>) {
+                out.push_back(StringConst { value: strings.intern(e.value) });
+            } else if constexpr (std::is_same_v<T, ListLiteral>) {
+                for (ExpressionRef expr : arena.expressions(e.value)) {
+                    insify_expression(expr);
+                }
+
+                out.push_back(ListConst { value: e.value.count });
+            } else if constexpr (std::is_same_v<T, Identifier<IndexName>>) {
+                std::visit([&](auto& id) {
+                    using T = std::decay_t<decltype(id)>;
+                    if constexpr (std::is_same_v<T, uint64_t>) {
+                        out.push_back(GetLocal { index: make_index(id) });
+                    } else if constexpr (std::is_same_v<T, string>) {
+                        out.push_back(GetGlobal { index: global_slot(id) });
+                    } else {
+                        static_assert(always_false_v<T>, "non-exhaustive visitor!");
+                    }
+                }, e.value);
+            } else if constexpr (std::is_same_v<T, BinaryOperation>) {
+                insify_expression(e.left);
+                insify_expression(e.right);
+                out.push_back(binop_instruction(e.flavor));
+            } else if constexpr (std::is_same_v<T, UnaryOperation>) {
+                insify_expression(e.content);
+                out.push_back(unop_instruction(e.flavor));
+            } else if constexpr (std::is_same_v<T, Index>) {
+                insify_expression(e.list);
+                insify_expression(e.number);
+                out.push_back(IIndex {});
+            } else if constexpr (std::is_same_v<T, Call>) {
+                for (ExpressionRef expr : arena.expressions(e.args)) {
+                    insify_expression(expr);
+                }
 
-            ins.push_back(ListConst { value: e.value.size() });
-            return ins;
-        } else if constexpr (std::is_same_v<T, Identifier<IndexName>>) {
-            return std::visit([](auto& id) -> Instructions {
-                using T = std::decay_t<decltype(id)>;
-                if constexpr (std::is_same_v<T, uint64_t>) {
-                    return {GetLocal { index: make_index(id) }};
-                } else if constexpr (std::is_same_v<T, string>) {
-                    return {StringConst { value: new string(id) }, GetFree {}};
+                // Calling a function by its name doesn't need the function as a value
+                if (const string* name = global_name(e.function); name != nullptr) {
+                    out.push_back(CallDirect { arg_count: make_arity(e.args.count), callee: global_slot(*name) });
                 } else {
-                    static_assert(always_false_v<T>, "non-exhaustive visitor!");
+                    insify_expression(e.function);
+                    out.push_back(CallUnknown { arg_count: make_arity(e.args.count) });
                 }
-            }, e.value);
-        } else if constexpr (std::is_same_v<T, BinaryOperation<IndexName>>) {
-            Instructions left = insify_expression(e.left.get());
-            Instructions right = insify_expression(e.right.get());
-
-            left.insert(left.end(), right.begin(), right.end());
-            left.push_back(CallKnown { arg_count: make_arity(2), ident: make_iident(stringify_binop(e.flavor)) });
-
-            return left;
-        } else if constexpr (std::is_same_v<T, UnaryOperation<IndexName>>) {
-            Instructions ins = insify_expression(e.content.get());
-
-            ins.push_back(CallKnown { arg_count: make_arity(1), ident: make_iident(stringify_unop(e.flavor)) });
-            return ins;
-        } else if constexpr (std::is_same_v<T, Index<IndexName>>) {
-            Instructions ins = insify_expression(e.list.get());
-            Instructions number = insify_expression(e.number.get());
-            
-            ins.insert(ins.end(), number.begin(), number.end());
-            ins.push_back(CallKnown { arg_count: make_arity(2), ident: make_iident("~[]") });
-            return ins;
-        } else if constexpr (std::is_same_v<T, Call<IndexName>>) {
-            Instructions ins  = {};
-            
-            for (IndexExpression expr : e.args) {
-                Instructions arg_ins = insify_expression(expr);
-                ins.insert(ins.end(), arg_ins.begin(), arg_ins.end());
+            } else {
+                static_assert(always_false_v<T>, "non-exhaustive visitor!");
             }
+        });
+    }
 
-            Instructions name_ins = insify_expression(e.function.get());
-            ins.insert(ins.end(), name_ins.begin(), name_ins.end());
-            ins.push_back(CallUnknown { arg_count: make_arity(e.args.size()) });
-            return ins;
+    void insify_if(IfPairList pairs, const std::optional<StatementList>& else_body) {
+        if (pairs.count == 0) {
+            if (const auto body = else_body; body) {
+                insify_statements(*body);
+            }
         } else {
-            static_assert(always_false_v<T>, "non-exhaustive visitor!");
+            const IfPair& first = arena.if_pairs[pairs.start];
+
+            insify_expression(first.condition);
+            size_t to_next = emit_forward<JumpIfFalse>();
+
+            insify_statements(first.body);
+
+            if (pairs.count > 1 || else_body) {
+                size_t to_end = emit_forward<Jump>();
+
+                land<JumpIfFalse>(to_next);
+                insify_if(IfPairList { start: pairs.start + 1, count: pairs.count - 1 }, else_body);
+                land<Jump>(to_end);
+            } else {
+                land<JumpIfFalse>(to_next);
+            }
         }
-    }, e);
-}
+    }
 
-// Forward declared for while, if
-Instructions insify_statements(const vector<IndexStatement>& s);
+    void insify_indexes(ExpressionList dexes) {
+        std::span<const ExpressionRef> exprs = arena.expressions(dexes);
 
-Instructions insify_if(
-    const vector<std::tuple<Expression<IndexName>, vector<Statement<IndexName>>>>& pairs,
-    const std::optional<vector<Statement<IndexName>>>& else_body)
-{
-    if (pairs.size() == 0) {
-        if (const auto body = else_body; body) {
-            return insify_statements(*body);
-        } else {
-            return {};
+        for (auto iter = exprs.begin(); iter != std::prev(exprs.end()); ++iter) {
+            insify_expression(*iter);
+            out.push_back(IIndex {});
         }
-    } else {
-        Instructions ins = {};
-        Instructions cond = insify_expression(std::get<0>(pairs[0]));
-        ins.insert(ins.end(), cond.begin(), cond.end());
-
-        ins.push_back(StartBlock {});
-        Instructions first_body = insify_statements(std::get<1>(pairs[0]));
-        ins.insert(ins.end(), first_body.begin(), first_body.end());
-        ins.push_back(EndBlock {});
-
-        ins.push_back(StartBlock {});
-        Instructions rest_body = insify_if(
-            std::vector<std::tuple<Expression<IndexName>, vector<Statement<IndexName>>>>(
-                pairs.begin() + 1,
-                pairs.end()
-            ),
-            else_body
-        );
-        ins.insert(ins.end(), rest_body.begin(), rest_body.end());
-        ins.push_back(EndBlock {});
-        
-        ins.push_back(IIf {});
-
-        return ins;
+
+        insify_expression(exprs[exprs.size() - 1]);
     }
-}
 
-Instructions insify_indexes(const vector<IndexExpression>& dexes) {
-    Instructions ins = {};
+    void insify_statement(StatementRef s) {
+        visit(arena, s, [&](auto& s) {
+            using T = std::decay_t<decltype(s)>;
+            if constexpr (std::is_same_v<T, If>) {
+                insify_if(s.if_pairs, s.else_body);
+            } else if constexpr (std::is_same_v<T, While>) {
+                size_t start = out.size();
+
+                insify_expression(s.condition);
+                size_t to_end = emit_forward<JumpIfFalse>();
+
+                insify_statements(s.body);
+
+                out.push_back(Loop { offset: JumpOffset { value: out.size() - start } });
+                land<JumpIfFalse>(to_end);
+            } else if constexpr (std::is_same_v<T, Return>) {
+                insify_expression(s.content);
+                out.push_back(IReturn {});
+            } else if constexpr (std::is_same_v<T, Assignment<IndexName>>) {
+                insify_expression(s.content);
+
+                std::visit([&](auto& id) {
+                    using T = std::decay_t<decltype(id)>;
+                    if constexpr (std::is_same_v<T, uint64_t>) {
+                        if (s.indexes.count > 0) {
+                            out.push_back(GetLocal { index: make_index(id) });
+                            insify_indexes(s.indexes);
+                            out.push_back(IIndexSet {});
+                        } else {
+                            out.push_back(SetLocal { index: make_index(id) });
+                        };
+                    } else if constexpr (std::is_same_v<T, string>) {
+                        if (s.indexes.count > 0) {
+                            out.push_back(GetGlobal { index: global_slot(id) });
+                            insify_indexes(s.indexes);
+                            out.push_back(IIndexSet {});
+                        } else {
+                            out.push_back(SetGlobal { index: global_slot(id) });
+                        };
+                    } else {
+                        static_assert(always_false_v<T>, "non-exhaustive visitor!");
+                    }
+                }, s.identifier);
+            } else if constexpr (std::is_same_v<T, VariableDeclaration<IndexName>>) {
+                insify_expression(s.content);
+                out.push_back(SetLocal { index: make_index(std::get<uint64_t>(s.identifier)) });
+            } else if constexpr (std::is_same_v<T, Do>) {
+                insify_expression(s.content);
+                out.push_back(Drop {});
+            } else {
+                static_assert(always_false_v<T>, "non-exhaustive visitor!");
+            }
+        });
+    }
 
-    for (auto iter = dexes.begin(); iter != std::prev(dexes.end()); ++iter) {
-        Instructions ie_ins = insify_expression(*iter);
-        ins.insert(ins.end(), ie_ins.begin(), ie_ins.end());
-        ins.push_back(CallKnown { arg_count: make_arity(2), ident: make_iident("~[]") });
+    void insify_statements(StatementList s) {
+        for (StatementRef stmt : arena.statements(s)) {
+            insify_statement(stmt);
+        }
     }
 
-    Instructions last_ins = insify_expression(dexes[dexes.size() - 1]);
-    ins.insert(ins.end(), last_ins.begin(), last_ins.end());
+    void insify_declaration(const IndexDeclaration& d) {
+        std::visit([&](auto& d) {
+            using T = std::decay_t<decltype(d)>;
+            if constexpr (std::is_same_v<T, Import>) {
+                out.push_back(StringConst { value: strings.intern(d.path) });
+                out.push_back(IImport {});
+            } else if constexpr (std::is_same_v<T, Global>) {
+                // Nothing to run, declaring it just reserves its slot
+                global_slot(d.identifier);
+            } else if constexpr (std::is_same_v<T, IndexFunction>) {
+                size_t header = out.size();
+                out.push_back(IFunc {
+                    parm_count: make_arity(d.parms.size()),
+                    ident: make_iident(d.identifier),
+                    code_size: 0,
+                    frame_size: d.frame_size,
+                    max_stack: 0,
+                });
+
+                insify_statements(d.body);
+
+                // Add a exit to the main function
+                if (d.identifier == "main") {
+                    out.push_back(IntegerConst { value: 0 });
+                    out.push_back(CallKnown { arg_count: make_arity(1), ident: make_iident("exit") });
+                    out.push_back(Drop {});
+                }
 
-    return ins;
-}
+                // Return null if nothing else has yet
+                out.push_back(NullConst {});
+                out.push_back(IReturn {});
 
-Instructions insify_statement(const IndexStatement& s) {
-    return std::visit([](auto& s) -> Instructions {
-        using T = std::decay_t<decltype(s)>;
-        if constexpr (std::is_same_v<T, If<IndexName>>) {
-            return insify_if(s.if_pairs, s.else_body);
-        } else if constexpr (std::is_same_v<T, While<IndexName>>) {
-            Instructions ins = {};
-            ins.push_back(StartBlock {});
-
-            Instructions cond_ins = insify_expression(s.condition);
-            ins.insert(ins.end(), cond_ins.begin(), cond_ins.end());
-
-            ins.push_back(BreakIf {});
-
-            Instructions body_ins = insify_statements(s.body);
-            ins.insert(ins.end(), body_ins.begin(), body_ins.end());
-
-            ins.push_back(EndBlock {});
-            ins.push_back(Loop {});
-            return ins;
-        } else if constexpr (std::is_same_v<T, Return<IndexName>>) {
-            Instructions ins = {};
-
-            Instructions expr_ins = insify_expression(s.content);
-            ins.insert(ins.end(), expr_ins.begin(), expr_ins.end());
-
-            ins.push_back(IReturn {});
-            return ins;
-        } else if constexpr (std::is_same_v<T, Assignment<IndexName>>) {;
-            return std::visit([&](auto& id) -> Instructions {
-                using T = std::decay_t<decltype(id)>;
-                if constexpr (std::is_same_v<T, uint64_t>) {
-                    Instructions ins = {};
-                    Instructions con_ins = insify_expression(s.content);
-                    ins.insert(ins.end(), con_ins.begin(), con_ins.end());
-
-                    if (s.indexes.size() > 0) {
-                        ins.push_back(GetLocal { index: make_index(id) });
-                        Instructions dexes_ins = insify_indexes(s.indexes);
-                        ins.insert(ins.end(), dexes_ins.begin(), dexes_ins.end());
-
-                        ins.push_back(CallKnown { arg_count: make_arity(3), ident: make_iident("==[]") });      
-                        return ins;
-                    } else {
-                        ins.push_back(SetLocal { index: make_index(id) });
-                        return ins;
-                    };
-                } else if constexpr (std::is_same_v<T, string>) {
-                    Instructions ins = {};
-                    Instructions con_ins = insify_expression(s.content);
-                    ins.insert(ins.end(), con_ins.begin(), con_ins.end());
+                std::get<IFunc>(out[header]).code_size = out.size() - header - 1;
+            } else {
+                static_assert(always_false_v<T>, "non-exhaustive visitor!");
+            }
+        }, d);
+    }
 
-                    if (s.indexes.size() > 0) {
-                        ins.push_back(StringConst { value: new string(id) });
-                        ins.push_back(GetFree {});
+private:
+    const IndexArena& arena;
+    Interner& strings;
+    vector<StringId>& globals;
+    Instructions& out;
 
-                        Instructions dexes_ins = insify_indexes(s.indexes);
-                        ins.insert(ins.end(), dexes_ins.begin(), dexes_ins.end());
+    std::unordered_map<StringId, uint64_t> global_slots;
 
-                        ins.push_back(CallKnown { arg_count: make_arity(3), ident: make_iident("==[]") });      
+    GlobalIndex global_slot(const string& name) {
+        StringId id = strings.intern(name);
+        auto [it, inserted] = global_slots.try_emplace(id, globals.size());
 
-                        return ins;
-                    } else {
-                        ins.push_back(StringConst { value: new string(id) });
-                        ins.push_back(SetFree {});
-                        return ins;
-                    };
-                } else {
-                    static_assert(always_false_v<T>, "non-exhaustive visitor!");
-                }
-            }, s.identifier);
-        } else if constexpr (std::is_same_v<T, VariableDeclaration<IndexName>>) {
-            Instructions ins = {};
+        if (inserted) {
+            globals.push_back(id);
+        }
+
+        return GlobalIndex { value: it->second };
+    }
+
+    // The name of a free variable, if that's what `e` is
+    const string* global_name(ExpressionRef e) {
+        if (e.kind != ExpressionKind::Identifier) {
+            return nullptr;
+        }
+
+        return std::get_if<string>(&arena.identifiers[e.index].value);
+    }
 
-            Instructions expr_ins = insify_expression(s.content);
-            ins.insert(ins.end(), expr_ins.begin(), expr_ins.end());
+    IIdentifier make_iident(const string& s) {
+        return IIdentifier { value: strings.intern(s) };
+    }
 
-            ins.push_back(SetLocal { index: make_index(std::get<uint64_t>(s.identifier)) });
+    // Emits a jump whose target isn't known yet, to be filled in by `land`
+    template<typename J>
+    size_t emit_forward() {
+        out.push_back(J { offset: JumpOffset { value: 0 } });
+        return out.size() - 1;
+    }
 
-            return ins;
-        } else if constexpr (std::is_same_v<T, Do<IndexName>>) {
-            Instructions ins = {};
+    // Points the jump at `at` to whatever gets emitted next
+    template<typename J>
+    void land(size_t at) {
+        std::get<J>(out[at]).offset = JumpOffset { value: out.size() - at };
+    }
+};
+
+// Moves a Program lowered on its own onto the end of `program`, renumbering its StringIds and
+// GlobalIndexes into the whole program's. A part numbers both in the order it first uses them, so
+// appending parts in declaration order numbers everything exactly like one Emitter would have.
+void append_part(Program& program, Program& part, std::unordered_map<StringId, uint64_t>& global_slots) {
+    vector<StringId> strings(part.strings.size());
+    for (StringId id = 0; id < part.strings.size(); id++) {
+        strings[id] = program.strings.intern(part.strings.get(id));
+    }
 
-            Instructions expr_ins = insify_expression(s.content);
-            ins.insert(ins.end(), expr_ins.begin(), expr_ins.end());
+    vector<uint64_t> globals(part.globals.size());
+    for (size_t i = 0; i < part.globals.size(); i++) {
+        StringId name = strings[part.globals[i]];
+        auto [it, inserted] = global_slots.try_emplace(name, program.globals.size());
 
-            ins.push_back(Drop {});
-            return ins;
-        } else { 
-            static_assert(always_false_v<T>, "non-exhaustive visitor!");
+        if (inserted) {
+            program.globals.push_back(name);
         }
-    }, s);
-}
 
-Instructions insify_statements(const vector<IndexStatement>& s) {
-    Instructions ins = {};
+        globals[i] = it->second;
+    }
 
-    for (IndexStatement stmt : s) {
-        Instructions stmt_ins = insify_statement(stmt);
-        ins.insert(ins.end(), stmt_ins.begin(), stmt_ins.end());
+    for (Instruction& in : part.instructions) {
+        std::visit([&](auto& in) {
+            using T = std::decay_t<decltype(in)>;
+            if constexpr (std::is_same_v<T, StringConst>) {
+                in.value = strings[in.value];
+            } else if constexpr (std::is_same_v<T, IFunc> || std::is_same_v<T, CallKnown>) {
+                in.ident.value = strings[in.ident.value];
+            } else if constexpr (std::is_same_v<T, GetGlobal> || std::is_same_v<T, SetGlobal>) {
+                in.index.value = globals[in.index.value];
+            } else if constexpr (std::is_same_v<T, CallDirect>) {
+                in.callee.value = globals[in.callee.value];
+            }
+        }, in);
     }
 
-    return ins;
+    program.instructions.insert(program.instructions.end(), part.instructions.begin(), part.instructions.end());
 }
 
-Instructions insify_declaration(const IndexDeclaration& d) {
-    return std::visit([](auto& d) -> Instructions {
-        using T = std::decay_t<decltype(d)>;
-        if constexpr (std::is_same_v<T, Import>) {
-            return {StringConst { value: new string(d.path) }, IImport {}};
-        } else if constexpr (std::is_same_v<T, Global>) {
-            return {StringConst { value: new string(d.identifier) }, IGlobal {}};
-        } else if constexpr (std::is_same_v<T, IndexFunction>) {
-            Instructions ins = {StartBlock {}};
-
-            Instructions body_ins = insify_statements(d.body);
-            ins.insert(ins.end(), body_ins.begin(), body_ins.end());
-
-            // Add a exit to the main function
-            if (d.identifier == "main") {
-                ins.push_back(IntegerConst { value: 0 });
-                ins.push_back(CallKnown { arg_count: make_arity(1), ident: make_iident("exit") });
+namespace codegen {
+    Program instructionify(const IndexAST& iast, size_t jobs) {
+        Program program = {};
+
+        if (jobs <= 1) {
+            Emitter emitter(iast.arena, program);
+
+            for (const IndexDeclaration& dec : iast.declarations) {
+                emitter.insify_declaration(dec);
             }
 
-            // Return null if nothing else has yet
-            ins.push_back(NullConst {});
-            ins.push_back(IReturn {});
+            return program;
+        }
 
-            ins.push_back(EndBlock {});
-            ins.push_back(IFunc { parm_count: make_arity(d.parms.size()), ident: make_iident(d.identifier) });
-            return ins;
-        } else {
-            static_assert(always_false_v<T>, "non-exhaustive visitor!");
+        // Each part gets its own Interner and buffers, so the threads never share anything
+        vector<Program> parts(iast.declarations.size());
+        parallel_for(parts.size(), jobs, [&](size_t i) {
+            Emitter emitter(iast.arena, parts[i]);
+            emitter.insify_declaration(iast.declarations[i]);
+        });
+
+        size_t size = 0;
+        for (const Program& part : parts) {
+            size += part.instructions.size();
         }
-    }, d);
-}
 
-namespace codegen {
-    Instructions instructionify(const IndexAST& iast) {
-        Instructions ins = {};
-    
-        for (IndexDeclaration dec : iast.declarations) {
-            Instructions dec_ins = insify_declaration(dec);
-            ins.insert(ins.end(), dec_ins.begin(), dec_ins.end());
+        program.instructions.reserve(size);
+        std::unordered_map<StringId, uint64_t> global_slots;
+        for (Program& part : parts) {
+            append_part(program, part, global_slots);
         }
-    
-        return ins;
+
+        return program;
     }
     
-    string instruction_to_string(const Instruction& in) {
-        return std::visit([](auto& in) -> string {
+    string instruction_to_string(const Instruction& in, const Program& program) {
+        const Interner& strings = program.strings;
+
+        return std::visit([&](auto& in) -> string {
             using T = std::decay_t<decltype(in)>;
             if constexpr (std::is_same_v<T, IImport>) {
                 return "Import";
             } else if constexpr (std::is_same_v<T, IFunc>) {
                 std::ostringstream out;
-                out << "IFunc parm_count=" << in.parm_count.value << " ident=" << *(in.ident.value);
+                out << "IFunc parm_count=" << in.parm_count.value << " ident=" << strings.get(in.ident.value)
+                    << " code_size=" << in.code_size << " frame_size=" << in.frame_size << " max_stack=" << in.max_stack;
                 return out.str();
-            } else if constexpr (std::is_same_v<T, StartBlock>) {
-                return "StartBlock";
-            } else if constexpr (std::is_same_v<T, EndBlock>) {
-                return "EndBlock";
             } else if constexpr (std::is_same_v<T, IReturn>) {
                 return "    IReturn";
             } else if constexpr (std::is_same_v<T, CallKnown>) {
                 std::ostringstream out;
-                out << "    CallKnown arg_count=" << in.arg_count.value << " ident=" << *(in.ident.value);
+                out << "    CallKnown arg_count=" << in.arg_count.value << " ident=" << strings.get(in.ident.value);
                 return out.str();
             } else if constexpr (std::is_same_v<T, CallUnknown>) {
                 return "    CallUnknown";
+            } else if constexpr (std::is_same_v<T, CallDirect>) {
+                std::ostringstream out;
+                out << "    CallDirect arg_count=" << in.arg_count.value << " @" << in.callee.value
+                    << " (" << strings.get(program.globals[in.callee.value]) << ")";
+                return out.str();
             } else if constexpr (std::is_same_v<T, NullConst>) {
                 return "    NullConst";
             } else if constexpr (std::is_same_v<T, BooleanConst>) {
@@ -413,7 +460,7 @@ namespace codegen {
                 return out.str();
             } else if constexpr (std::is_same_v<T, StringConst>) {
                 std::ostringstream out;
-                out  << "    StringConst value=\"" << *(in.value) << "\"";
+                out  << "    StringConst value=\"" << strings.get(in.value) << "\"";
                 return out.str();
             } else if constexpr (std::is_same_v<T, ListConst>) {
                 std::ostringstream out;
@@ -427,32 +474,85 @@ namespace codegen {
                 std::ostringstream out;
                 out << "    SetLocal $" << in.index.value;
                 return out.str();
+            } else if constexpr (std::is_same_v<T, TeeLocal>) {
+                std::ostringstream out;
+                out << "    TeeLocal $" << in.index.value;
+                return out.str();
             } else if constexpr (std::is_same_v<T, Drop>) {
                 return "    Drop";
-            } else if constexpr (std::is_same_v<T, IIf>) {
-                return "    IIf";
+            } else if constexpr (std::is_same_v<T, Jump>) {
+                std::ostringstream out;
+                out << "    Jump +" << in.offset.value;
+                return out.str();
+            } else if constexpr (std::is_same_v<T, JumpIfFalse>) {
+                std::ostringstream out;
+                out << "    JumpIfFalse +" << in.offset.value;
+                return out.str();
             } else if constexpr (std::is_same_v<T, Loop>) {
-                return "    Loop";
-            } else if constexpr (std::is_same_v<T, BreakIf>) {
-                return "    BreakIf";
+                std::ostringstream out;
+                out << "    Loop -" << in.offset.value;
+                return out.str();
             } else if constexpr (std::is_same_v<T, IGlobal>) {
                 return "IGlobal";
             } else if constexpr (std::is_same_v<T, GetFree>) {
                 return "    GetFree";
             } else if constexpr (std::is_same_v<T, SetFree>) {
                 return "    SetFree";
+            } else if constexpr (std::is_same_v<T, GetGlobal>) {
+                std::ostringstream out;
+                out << "    GetGlobal @" << in.index.value << " (" << strings.get(program.globals[in.index.value]) << ")";
+                return out.str();
+            } else if constexpr (std::is_same_v<T, SetGlobal>) {
+                std::ostringstream out;
+                out << "    SetGlobal @" << in.index.value << " (" << strings.get(program.globals[in.index.value]) << ")";
+                return out.str();
+            } else if constexpr (std::is_same_v<T, IAdd>) {
+                return "    Add";
+            } else if constexpr (std::is_same_v<T, ISub>) {
+                return "    Sub";
+            } else if constexpr (std::is_same_v<T, IMul>) {
+                return "    Mul";
+            } else if constexpr (std::is_same_v<T, IDiv>) {
+                return "    Div";
+            } else if constexpr (std::is_same_v<T, IMod>) {
+                return "    Mod";
+            } else if constexpr (std::is_same_v<T, IEq>) {
+                return "    Eq";
+            } else if constexpr (std::is_same_v<T, INe>) {
+                return "    Ne";
+            } else if constexpr (std::is_same_v<T, ILt>) {
+                return "    Lt";
+            } else if constexpr (std::is_same_v<T, ILe>) {
+                return "    Le";
+            } else if constexpr (std::is_same_v<T, IGt>) {
+                return "    Gt";
+            } else if constexpr (std::is_same_v<T, IGe>) {
+                return "    Ge";
+            } else if constexpr (std::is_same_v<T, IAnd>) {
+                return "    And";
+            } else if constexpr (std::is_same_v<T, IOr>) {
+                return "    Or";
+            } else if constexpr (std::is_same_v<T, INegate>) {
+                return "    Negate";
+            } else if constexpr (std::is_same_v<T, INot>) {
+                return "    Not";
+            } else if constexpr (std::is_same_v<T, IIndex>) {
+                return "    Index";
+            } else if constexpr (std::is_same_v<T, IIndexSet>) {
+                return "    IndexSet";
             } else {
                 static_assert(always_false_v<T>, "non-exhaustive visitor!");
             }
         }, in);
     }
     
-    string intructions_to_string(const Instructions& ins) {
+    string intructions_to_string(const Program& program) {
+        const Instructions& ins = program.instructions;
         vector<string> str_ins = {};
     
         std::transform(ins.begin(), ins.end(), std::back_inserter(str_ins),
             [&](auto& in) -> string {
-                return instruction_to_string(in);
+                return instruction_to_string(in, program);
             });
     
         const char* const delim = "\n";
@@ -8,6 +8,7 @@
 #include <variant>
 
 #include "ast.hpp"
+#include "interner.hpp"
 
 using string = std::string;
 
@@ -20,8 +21,17 @@ namespace codegen {
         uint64_t value;
     };
 
+    struct GlobalIndex {
+        uint64_t value;
+    };
+
+    // Distance in instructions from a jump to its target
+    struct JumpOffset {
+        uint64_t value;
+    };
+
     struct IIdentifier {
-        string* value;
+        StringId value;
     };
 
     /*
@@ -39,16 +49,18 @@ namespace codegen {
      * Function stuff
      */
 
-    // [block] -> []
+    // [] -> []
+    // The `code_size` instructions after it are the function's body, and get skipped over. A call
+    // needs `frame_size` locals, and never has more than `max_stack` values on the stack once
+    // compute_stack_depths has filled it in.
     struct IFunc {
         Arity parm_count;
         IIdentifier ident;
+        uint64_t code_size;
+        uint64_t frame_size;
+        uint64_t max_stack;
     };
 
-    // [???] -> ???
-    struct StartBlock {};
-    struct EndBlock {};
-
     // [any] -> ⊥
     struct IReturn {};
 
@@ -63,6 +75,15 @@ namespace codegen {
         Arity arg_count;
     };
 
+    // [...any] -> any
+    // Calls whatever `callee` holds once it's been set, and the top-level function of the same
+    // name before that, without pushing the function first. Which function a name means isn't
+    // known until the file's imports have run, so the runtime works it out on the first call.
+    struct CallDirect {
+        Arity arg_count;
+        GlobalIndex callee;
+    };
+
     /*
      * Constants
      */
@@ -82,7 +103,7 @@ namespace codegen {
 
     // [] -> string
     struct StringConst {
-        string* value;
+        StringId value;
     };
 
     // [...any] -> any list
@@ -104,6 +125,12 @@ namespace codegen {
         LocalIndex index;
     };
 
+    // [any] -> any
+    // SetLocal that leaves the value where it was, only ever made by the peephole pass
+    struct TeeLocal {
+        LocalIndex index;
+    };
+
     /*
      * Control Flow
      */
@@ -111,14 +138,23 @@ namespace codegen {
     // [any] -> []
     struct Drop {};
 
-    // [bool, block, block] -> []
-    struct IIf {};
+    // [] -> []
+    // Forwards, to `offset` instructions after itself
+    struct Jump {
+        JumpOffset offset;
+    };
 
-    // [block] -> []
-    struct Loop {};
+    // [bool] -> []
+    // Forwards like Jump, but only when the condition is falsy
+    struct JumpIfFalse {
+        JumpOffset offset;
+    };
 
-    // [bool] -> ⊥
-    struct BreakIf {};
+    // [] -> []
+    // Backwards, to `offset` instructions before itself
+    struct Loop {
+        JumpOffset offset;
+    };
 
     /*
      * Global stuff
@@ -127,6 +163,16 @@ namespace codegen {
     // [string] -> []
     struct IGlobal {};
 
+    // [] -> any
+    struct GetGlobal {
+        GlobalIndex index;
+    };
+
+    // [any] -> []
+    struct SetGlobal {
+        GlobalIndex index;
+    };
+
     /*
      * Free binding operations
      */
@@ -138,31 +184,74 @@ namespace codegen {
     struct SetFree {};
 
     /*
-     * Special Built-ins
+     * Operators
      */
 
-    // ~[] : [list, int] -> any
-    // ==[] : [any, list, int] -> []
+    // [any, any] -> any
+    struct IAdd {};
+    struct ISub {};
+    struct IMul {};
+    struct IDiv {};
+    struct IMod {};
+
+    // [any, any] -> bool
+    struct IEq {};
+    struct INe {};
+    struct ILt {};
+    struct ILe {};
+    struct IGt {};
+    struct IGe {};
+    struct IAnd {};
+    struct IOr {};
+
+    // [any] -> any
+    struct INegate {};
+    struct INot {};
+
+    // [list, int] -> any
+    struct IIndex {};
+
+    // [any, list, int] -> []
+    struct IIndexSet {};
 
     /*
      * Aliases
      */
 
     using Instruction = std::variant<
-        IImport, IFunc, StartBlock,
-        EndBlock, IReturn, CallKnown,
-        CallUnknown, NullConst, BooleanConst,
+        IImport, IFunc, IReturn,
+        CallKnown, CallUnknown, CallDirect,
+        NullConst, BooleanConst,
         IntegerConst, StringConst,
-        ListConst, GetLocal, SetLocal,
-        Drop, IIf, Loop, BreakIf,
-        IGlobal, GetFree, SetFree
+        ListConst, GetLocal, SetLocal, TeeLocal,
+        Drop, Jump, JumpIfFalse, Loop,
+        IGlobal, GetFree, SetFree,
+        GetGlobal, SetGlobal,
+        IAdd, ISub, IMul, IDiv, IMod,
+        IEq, INe, ILt, ILe, IGt, IGe,
+        IAnd, IOr, INegate, INot,
+        IIndex, IIndexSet
     >;
 
     using Instructions = std::vector<Instruction>;
 
-    Instructions instructionify(const IndexAST&);
+    struct Program {
+        Interner strings;
+
+        // Every free variable the program mentions, indexed by GlobalIndex. A file is compiled on
+        // its own, so these slots are only dense within it; the runtime links them to its own
+        // program-wide slots by name when the file is loaded.
+        vector<StringId> globals;
+
+        Instructions instructions;
+    };
+
+    // With more than one job, each declaration is lowered into a Program of its own on up to
+    // `jobs` threads, and the pieces are stitched together in order afterwards. The result is
+    // the same either way.
+    Program instructionify(const IndexAST&, size_t jobs = 1);
 
-    string intructions_to_string(const Instructions&);
+    string intructions_to_string(const Program&);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,17 @@
+#include "interner.hpp"
+
+namespace codegen {
+    StringId Interner::intern(std::string_view s) {
+        auto got = ids.find(s);
+
+        if (got != ids.end()) {
+            return got->second;
+        }
+
+        StringId id = static_cast<StringId>(strings.size());
+        const string& stored = strings.emplace_back(s);
+        ids.emplace(std::string_view(stored), id);
+
+        return id;
+    }
+}
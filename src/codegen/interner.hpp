@@ -0,0 +1,43 @@
+#ifndef INTERNER_CODEGEN
+#define INTERNER_CODEGEN
+
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using string = std::string;
+
+namespace codegen {
+    using StringId = uint32_t;
+
+    // Stores every distinct identifier and string literal of a program once, and hands out
+    // stable ids for them. Strings never move once interned, so views of them stay valid for
+    // as long as the Interner does.
+    class Interner {
+    public:
+        Interner() = default;
+
+        // Copying would leave `ids` viewing the other Interner's strings
+        Interner(const Interner&) = delete;
+        Interner(Interner&&) = default;
+
+        StringId intern(std::string_view s);
+
+        const string& get(StringId id) const {
+            return strings[id];
+        }
+
+        size_t size() const {
+            return strings.size();
+        }
+
+    private:
+        std::deque<string> strings;
+        std::unordered_map<std::string_view, StringId> ids;
+    };
+}
+
+#endif
@@ -19,11 +19,17 @@ extern "C"
 }
 
 #include <cstring>
+#include <fstream>
 #include <iostream>
 
 #include "ast.hpp"
+#include "bytecode.hpp"
+#include "fold.hpp"
 #include "middle_end.hpp"
 #include "instructions.hpp"
+#include "passes.hpp"
+#include "peephole.hpp"
+#include "stack_depth.hpp"
 
 using namespace codegen;
 
@@ -55,12 +61,50 @@ int main(int argc, char** argv) {
         return -1;
     }
 
+    // `-o <path>` writes a bytecode image merc can run directly, instead of dumping instructions.
+    // `-j <n>` lowers functions on n threads.
+    // `-O<n>` optimizes at level n, 0 (the default) doesn't optimize and 1 folds constants and
+    // runs the peephole pass.
+    // `--time-passes` and `--mem-passes` print how long each pass took and how much it allocated.
+    // `--peephole-stats` prints how often each peephole rule fired.
+    const char* image_path = NULL;
+    size_t jobs = 1;
+    unsigned long opt_level = 0;
+    bool time_passes = false;
+    bool mem_passes = false;
+    bool peephole_stats = false;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            image_path = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = strtoul(argv[++i], NULL, 10);
+        } else if (strncmp(argv[i], "-O", 2) == 0) {
+            opt_level = argv[i][2] == '\0' ? 1 : strtoul(argv[i] + 2, NULL, 10);
+        } else if (strcmp(argv[i], "--time-passes") == 0) {
+            time_passes = true;
+        } else if (strcmp(argv[i], "--mem-passes") == 0) {
+            mem_passes = true;
+        } else if (strcmp(argv[i], "--peephole-stats") == 0) {
+            peephole_stats = true;
+        } else {
+            fprintf(stderr, "Unknown argument %s!\n", argv[i]);
+            return -1;
+        }
+    }
+
     char* file = read_entire_file(argv[1]);
         if (file == NULL) {
         fputs("Could not read file!\n", stderr);
         return -1;
     }
 
+    vector<PassStats> passes;
+    PassTimer timer(time_passes || mem_passes ? &passes : NULL);
+
+    if (time_passes || mem_passes) {
+        timer.end("lex", "tokens", count_tokens(file));
+    }
+
     const char* stream = file;
     const char* error = NULL;
 
@@ -79,11 +123,62 @@ int main(int argc, char** argv) {
         return -1;
     }
 
+    timer.end("parse_program", "bytes", len);
+
     //pp_program(program);
 
     const StringAST ast = to_cpp_ast(&program);
+    timer.end("to_cpp_ast", "nodes", count_nodes(ast));
+
+    IndexAST iast = de_bruijnify(ast, jobs);
+    timer.end("de_bruijnify", "nodes", count_nodes(ast));
+
+    if (opt_level >= 1) {
+        fold_constants(iast);
+        timer.end_counted("fold_constants", "nodes", [&]() { return count_reachable_nodes(iast); });
+    }
+
+    Program compiled = instructionify(iast, jobs);
+    timer.end("instructionify", "instructions", compiled.instructions.size());
+
+    PeepholeStats rules;
+    if (opt_level >= 1) {
+        rules = peephole(compiled);
+        timer.end("peephole", "instructions", compiled.instructions.size());
+    }
+
+    compute_stack_depths(compiled);
+    timer.end("stack_depths", "instructions", compiled.instructions.size());
+
+    auto report = [&]() {
+        if (time_passes || mem_passes) {
+            print_passes(stderr, passes, time_passes, mem_passes);
+        }
+        if (peephole_stats) {
+            print_peephole_stats(stderr, rules);
+        }
+    };
+
+    if (image_path != NULL) {
+        const Bytecode bytecode = encode(compiled);
+        timer.end("encode", "instructions", compiled.instructions.size());
+
+        const string image = write_image(compiled, bytecode);
+        timer.end("write_image", "bytes", image.size());
+        report();
+
+        std::ofstream out(image_path, std::ios::binary);
+        out.write(image.data(), image.size());
+
+        if (!out) {
+            fputs("Could not write image!\n", stderr);
+            return -1;
+        }
+
+        return 0;
+    }
+
+    report();
 
-    const IndexAST iast = de_bruijnify(ast);
-    const Instructions ins = instructionify(iast);
-    std::cout << intructions_to_string(ins) << std::endl;
+    std::cout << intructions_to_string(compiled) << std::endl;
 }
\ No newline at end of file
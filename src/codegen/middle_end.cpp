@@ -2,199 +2,218 @@
 
 #include <algorithm>
 #include <optional>
+#include <string_view>
 #include <unordered_map>
 
 #include "ast.hpp"
 #include "middle_end.hpp"
+#include "parallel.hpp"
 
 using namespace codegen;
 
 template<class> inline constexpr bool always_false_v = false;
 
-IndexName find_or_ident(const std::unordered_map<string, uint64_t>& imap, const string& key) {
-    std::unordered_map<string, uint64_t>::const_iterator got = imap.find(key);
+// Maps names to local slots. Bindings go in one hash map, and whatever a binding shadowed is
+// pushed on an undo log, so leaving a scope just replays the log back to the scope's mark.
+// Names point into the StringAST, which outlives the table.
+class SymbolTable {
+public:
+    void enter_scope() {
+        marks.push_back(Mark { undo_size: undo.size(), next_slot: next_slot });
+    }
+
+    void exit_scope() {
+        Mark mark = marks.back();
+        marks.pop_back();
+
+        while (undo.size() > mark.undo_size) {
+            Shadowed& s = undo.back();
+
+            if (s.slot) {
+                bindings[s.name] = *s.slot;
+            } else {
+                bindings.erase(s.name);
+            }
+
+            undo.pop_back();
+        }
 
-    if (got == imap.end()) {
-        return key;
-    } else {
-        return got->second;
+        next_slot = mark.next_slot;
     }
-}
 
-IndexExpression debify_expression(const StringExpression& e, const std::unordered_map<string, uint64_t>& imap) {
-    return std::visit([&](auto& e) -> IndexExpression {
+    uint64_t bind(std::string_view name) {
+        uint64_t slot = next_slot++;
+        frame_size = std::max(frame_size, next_slot);
+        auto [it, inserted] = bindings.try_emplace(name, slot);
+
+        if (inserted) {
+            undo.push_back(Shadowed { name: name, slot: std::nullopt });
+        } else {
+            undo.push_back(Shadowed { name: name, slot: it->second });
+            it->second = slot;
+        }
+
+        return slot;
+    }
+
+    IndexName find_or_ident(const string& key) const {
+        auto got = bindings.find(key);
+
+        if (got == bindings.end()) {
+            return key;
+        } else {
+            return got->second;
+        }
+    }
+
+    // How many slots were ever live at once, which is all a call to the function needs. Slots
+    // get reused once their scope is gone.
+    uint64_t frame_size = 0;
+
+private:
+    struct Shadowed {
+        std::string_view name;
+        std::optional<uint64_t> slot;
+    };
+
+    struct Mark {
+        size_t undo_size;
+        uint64_t next_slot;
+    };
+
+    std::unordered_map<std::string_view, uint64_t> bindings;
+    vector<Shadowed> undo;
+    vector<Mark> marks;
+    uint64_t next_slot = 0;
+};
+
+// Everything but the identifier-carrying pools is copied over wholesale by de_bruijnify,
+// so the walks below only have to fill in `identifiers`, `assignments` and `variable_declarations`
+// at the same indexes they had in the StringAST
+void debify_expression(
+    const StringArena& sarena,
+    IndexArena& iarena,
+    ExpressionRef e,
+    const SymbolTable& symbols
+) {
+    visit(sarena, e, [&](auto& e) {
         using T = std::decay_t<decltype(e)>;
         if constexpr (std::is_same_v<T, NullLiteral>) {
-            return NullLiteral {};
         } else if constexpr (std::is_same_v<T, BooleanLiteral>) {
-            return BooleanLiteral { value: e.value };
         } else if constexpr (std::is_same_v<T, IntegerLiteral>) {
-            return IntegerLiteral { value: e.value };
         } else if constexpr (std::is_same_v<T, StringLiteral>) {
-            return StringLiteral { value: e.value };
-        } else if constexpr (std::is_same_v<T, ListLiteral<string>>) {
-            vector<Expression<IndexName>> new_vals = {};
-
-            std::transform(e.value.begin(), e.value.end(), std::back_inserter(new_vals),
-                [&](auto& d) -> Expression<IndexName> {
-                    return debify_expression(d, imap);
-                });
-
-            return ListLiteral<IndexName> {
-                value: new_vals,
-            };
+        } else if constexpr (std::is_same_v<T, ListLiteral>) {
+            for (ExpressionRef d : sarena.expressions(e.value)) {
+                debify_expression(sarena, iarena, d, symbols);
+            }
         } else if constexpr (std::is_same_v<T, Identifier<string>>) {
-            std::unordered_map<string, uint64_t> new_imap = imap;
-            return Identifier<IndexName> {
-                value: find_or_ident(imap, e.value),
-            };
-        } else if constexpr (std::is_same_v<T, BinaryOperation<string>>) {
-            return BinaryOperation<IndexName> {
-                left: make_gross<Expression<IndexName>>(debify_expression(e.left.get(), imap)),
-                flavor: e.flavor,
-                right: make_gross(debify_expression(e.right.get(), imap)),
-            };
-        } else if constexpr (std::is_same_v<T, UnaryOperation<string>>) {
-            return UnaryOperation<IndexName> {
-                flavor: e.flavor,
-                content: make_gross<Expression<IndexName>>(debify_expression(e.content.get(), imap)),
-            };
-        } else if constexpr (std::is_same_v<T, Index<string>>) {
-            return Index<IndexName> {
-                list: make_gross<Expression<IndexName>>(debify_expression(e.list.get(), imap)),
-                number: make_gross<Expression<IndexName>>(debify_expression(e.number.get(), imap)),
-            };
-        } else if constexpr (std::is_same_v<T, Call<string>>) {
-            vector<Expression<IndexName>> new_args = {};
-
-            std::transform(e.args.begin(), e.args.end(), std::back_inserter(new_args),
-                [&](auto& d) -> Expression<IndexName> {
-                    return debify_expression(d, imap);
-                });
-
-            return Call<IndexName> {
-                function: make_gross<Expression<IndexName>>(debify_expression(e.function.get(), imap)),
-                args: new_args,
+            iarena.identifiers[&e - sarena.identifiers.data()] = Identifier<IndexName> {
+                value: symbols.find_or_ident(e.value),
             };
+        } else if constexpr (std::is_same_v<T, BinaryOperation>) {
+            debify_expression(sarena, iarena, e.left, symbols);
+            debify_expression(sarena, iarena, e.right, symbols);
+        } else if constexpr (std::is_same_v<T, UnaryOperation>) {
+            debify_expression(sarena, iarena, e.content, symbols);
+        } else if constexpr (std::is_same_v<T, Index>) {
+            debify_expression(sarena, iarena, e.list, symbols);
+            debify_expression(sarena, iarena, e.number, symbols);
+        } else if constexpr (std::is_same_v<T, Call>) {
+            for (ExpressionRef d : sarena.expressions(e.args)) {
+                debify_expression(sarena, iarena, d, symbols);
+            }
+
+            debify_expression(sarena, iarena, e.function, symbols);
         } else {
             static_assert(always_false_v<T>, "non-exhaustive visitor!");
         }
-    }, e);
+    });
 }
 
-vector<IndexStatement> debify_statements(
-    const vector<StringStatement>& s,
-    uint64_t i,
-    std::unordered_map<string, uint64_t>& imap
-) {
-    std::vector<IndexStatement> new_stats = {};
-
-    std::transform(s.begin(), s.end(), std::back_inserter(new_stats), [&](const StringStatement& d) -> IndexStatement {
-            return std::visit([&](auto& d) -> IndexStatement {
-                using T = std::decay_t<decltype(d)>;
-                if constexpr (std::is_same_v<T, If<string>>) {
-                    std::unordered_map<string, uint64_t> temp_imap = imap;
-
-                    vector<std::tuple<Expression<IndexName>, vector<Statement<IndexName>>>> new_pairs = {};
-
-                    std::transform(d.if_pairs.begin(), d.if_pairs.end(), std::back_inserter(new_pairs),
-                        [&](auto& d) -> std::tuple<Expression<IndexName>, vector<Statement<IndexName>>> {
-                            return std::tuple<Expression<IndexName>, vector<Statement<IndexName>>>(
-                                debify_expression(std::get<0>(d), temp_imap),
-                                debify_statements(std::get<1>(d), i, temp_imap)
-                            );
-                        });
-
-                    if (auto body = d.else_body; body) {
-                        return If<IndexName> {
-                            if_pairs: new_pairs,
-                            else_body: debify_statements(*body, i, temp_imap),
-                        };
-                    } else {
-                        return If<IndexName> {
-                            if_pairs: new_pairs,
-                            else_body: std::nullopt,
-                        };
-                    }
-
-
-                } else if constexpr (std::is_same_v<T, While<string>>) {
-                    std::unordered_map<string, uint64_t> temp_imap = imap;
-                    return While<IndexName> {
-                        condition: debify_expression(d.condition, temp_imap),
-                        body: debify_statements(d.body, i, temp_imap),
-                    };
-                } else if constexpr (std::is_same_v<T, Return<string>>) {
-                    return Return<IndexName> {
-                        content: debify_expression(d.content, imap),
-                    };
-                } else if constexpr (std::is_same_v<T, Assignment<string>>) {
-                    vector<Expression<IndexName>> new_exps = {};
-
-                    std::transform(d.indexes.begin(), d.indexes.end(), std::back_inserter(new_exps),
-                        [&](auto& d) -> Expression<IndexName> {
-                            return debify_expression(d, imap);
-                        });
-
-                    return Assignment<IndexName> {
-                        identifier: find_or_ident(imap, d.identifier),
-                        indexes: new_exps,
-                        content: debify_expression(d.content, imap),
-                    };
-                } else if constexpr (std::is_same_v<T, VariableDeclaration<string>>) {
-                    uint64_t current = i;
-                    
-                    std::unordered_map<string, uint64_t> old_imap = imap;
-                    imap[d.identifier] = current;
-                    i += 1;
-
-                    return VariableDeclaration<IndexName> {
-                        identifier: current,
-                        content: debify_expression(d.content, old_imap),
-                    };
-                } else if constexpr (std::is_same_v<T, Do<string>>) {
-                    return Do<IndexName> {
-                        content: debify_expression(d.content, imap),
-                    };
-                } else { 
-                    static_assert(always_false_v<T>, "non-exhaustive visitor!");
+void debify_statements(const StringArena& sarena, IndexArena& iarena, StatementList s, SymbolTable& symbols) {
+    for (StatementRef d : sarena.statements(s)) {
+        visit(sarena, d, [&](auto& d) {
+            using T = std::decay_t<decltype(d)>;
+            if constexpr (std::is_same_v<T, If>) {
+                for (const IfPair& pair : sarena.pairs(d.if_pairs)) {
+                    debify_expression(sarena, iarena, pair.condition, symbols);
+
+                    symbols.enter_scope();
+                    debify_statements(sarena, iarena, pair.body, symbols);
+                    symbols.exit_scope();
+                }
+
+                if (auto body = d.else_body; body) {
+                    symbols.enter_scope();
+                    debify_statements(sarena, iarena, *body, symbols);
+                    symbols.exit_scope();
+                }
+            } else if constexpr (std::is_same_v<T, While>) {
+                debify_expression(sarena, iarena, d.condition, symbols);
+
+                symbols.enter_scope();
+                debify_statements(sarena, iarena, d.body, symbols);
+                symbols.exit_scope();
+            } else if constexpr (std::is_same_v<T, Return>) {
+                debify_expression(sarena, iarena, d.content, symbols);
+            } else if constexpr (std::is_same_v<T, Assignment<string>>) {
+                for (ExpressionRef e : sarena.expressions(d.indexes)) {
+                    debify_expression(sarena, iarena, e, symbols);
                 }
-            }, d);
-        });
 
-    return new_stats;
+                debify_expression(sarena, iarena, d.content, symbols);
+
+                iarena.assignments[&d - sarena.assignments.data()] = Assignment<IndexName> {
+                    identifier: symbols.find_or_ident(d.identifier),
+                    indexes: d.indexes,
+                    content: d.content,
+                };
+            } else if constexpr (std::is_same_v<T, VariableDeclaration<string>>) {
+                // The initializer can't see the variable it's initializing
+                debify_expression(sarena, iarena, d.content, symbols);
+
+                iarena.variable_declarations[&d - sarena.variable_declarations.data()] = VariableDeclaration<IndexName> {
+                    identifier: symbols.bind(d.identifier),
+                    content: d.content,
+                };
+            } else if constexpr (std::is_same_v<T, Do>) {
+                debify_expression(sarena, iarena, d.content, symbols);
+            } else {
+                static_assert(always_false_v<T>, "non-exhaustive visitor!");
+            }
+        });
+    }
 }
 
-IndexFunction debify_function(const StringFunction& f) {
-    std::unordered_map<string, uint64_t> index_map = {};
+IndexFunction debify_function(const StringArena& sarena, IndexArena& iarena, const StringFunction& f) {
+    SymbolTable symbols = {};
     std::vector<IndexName> new_parms = {};
 
-    uint64_t i = 0;
     std::transform(f.parms.begin(), f.parms.end(), std::back_inserter(new_parms), [&](const string& d) -> uint64_t {
-            uint64_t current = i;
-            index_map.insert({d, current});
-            i++;
-            return current;
+            return symbols.bind(d);
         });
 
+    debify_statements(sarena, iarena, f.body, symbols);
+
     return IndexFunction {
         identifier: f.identifier,
         // These should always be uints
         parms: new_parms,
-        body: debify_statements(f.body, i, index_map),
+        body: f.body,
+        frame_size: symbols.frame_size,
     };
 }
 
-IndexDeclaration debify_declaration(const StringDeclaration& d) {
-    return std::visit([](auto& d) -> IndexDeclaration {
+IndexDeclaration debify_declaration(const StringArena& sarena, IndexArena& iarena, const StringDeclaration& d) {
+    return std::visit([&](auto& d) -> IndexDeclaration {
         using T = std::decay_t<decltype(d)>;
         if constexpr (std::is_same_v<T, Import>) {
             return d;
         } else if constexpr (std::is_same_v<T, Global>) {
             return d;
         } else if constexpr (std::is_same_v<T, StringFunction>) {
-            return debify_function(d);
-        } else { 
+            return debify_function(sarena, iarena, d);
+        } else {
             static_assert(always_false_v<T>, "non-exhaustive visitor!");
         }
     }, d);
@@ -202,14 +221,21 @@ IndexDeclaration debify_declaration(const StringDeclaration& d) {
 
 
 namespace codegen {
-    IndexAST de_bruijnify(const StringAST& sast) {
-        std::vector<IndexDeclaration> new_decs = {};
-
-        std::transform(sast.declarations.begin(), sast.declarations.end(), std::back_inserter(new_decs),
-            [](const StringDeclaration& d) -> IndexDeclaration { return debify_declaration(d); });
+    IndexAST de_bruijnify(const StringAST& sast, size_t jobs) {
+        IndexAST iast = {};
+
+        static_cast<ArenaNodes&>(iast.arena) = static_cast<const ArenaNodes&>(sast.arena);
+        iast.arena.identifiers.resize(sast.arena.identifiers.size());
+        iast.arena.assignments.resize(sast.arena.assignments.size());
+        iast.arena.variable_declarations.resize(sast.arena.variable_declarations.size());
+
+        // Every node belongs to exactly one function, so functions only ever write to their own
+        // slots of the pools resized above
+        iast.declarations.resize(sast.declarations.size());
+        parallel_for(sast.declarations.size(), jobs, [&](size_t i) {
+            iast.declarations[i] = debify_declaration(sast.arena, iast.arena, sast.declarations[i]);
+        });
 
-        return AST<IndexName> {
-            declarations: new_decs,
-        };
+        return iast;
     }
-}
\ No newline at end of file
+}
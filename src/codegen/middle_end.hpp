@@ -4,7 +4,8 @@
 #include "ast.hpp"
 
 namespace codegen {
-    IndexAST de_bruijnify(const StringAST&);
+    // Functions are resolved independently of each other, on up to `jobs` threads
+    IndexAST de_bruijnify(const StringAST&, size_t jobs = 1);
 }
 
 #endif
\ No newline at end of file
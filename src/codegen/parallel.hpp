@@ -0,0 +1,56 @@
+#ifndef PARALLEL_CODEGEN
+#define PARALLEL_CODEGEN
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "passes.hpp"
+
+namespace codegen {
+    // Calls `f(i)` for every i below `count` on up to `jobs` threads, the calling one included.
+    // Threads grab the next index whenever they finish one, so a few huge functions don't hold
+    // up everyone else. Which thread runs what isn't deterministic, so `f` must only write to
+    // things that belong to its own index. Whatever the workers use is charged to the calling
+    // thread, so timing a pass counts the work it farmed out.
+    template<typename F>
+    void parallel_for(size_t count, size_t jobs, F&& f) {
+        size_t threads = std::min(jobs, count);
+
+        if (threads <= 1) {
+            for (size_t i = 0; i < count; i++) {
+                f(i);
+            }
+
+            return;
+        }
+
+        std::atomic<size_t> next = 0;
+        auto work = [&]() {
+            for (size_t i = next++; i < count; i = next++) {
+                f(i);
+            }
+        };
+
+        std::vector<Usage> used(threads - 1);
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < threads; i++) {
+            workers.emplace_back([&, i]() {
+                work();
+                used[i - 1] = thread_usage();
+            });
+        }
+
+        work();
+
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+            charge_usage(used[i]);
+        }
+    }
+}
+
+#endif
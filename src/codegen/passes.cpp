@@ -0,0 +1,217 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+extern "C"
+{
+    #include "../lexer/lexer.h"
+}
+
+#include "passes.hpp"
+
+namespace codegen {
+    thread_local constinit AllocationCounts allocation_counts = AllocationCounts {};
+    std::atomic<uint32_t> counting_allocations = 0;
+
+    CountAllocations::CountAllocations() {
+        counting_allocations++;
+    }
+
+    CountAllocations::~CountAllocations() {
+        counting_allocations--;
+    }
+
+    static thread_local Usage charged = Usage {};
+
+    static double thread_cpu_seconds() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+        struct timespec now;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        return now.tv_sec + now.tv_nsec / 1e9;
+#else
+        return (double)clock() / CLOCKS_PER_SEC;
+#endif
+    }
+
+    Usage thread_usage() {
+        return Usage {
+            cpu_seconds: thread_cpu_seconds() + charged.cpu_seconds,
+            allocations: allocation_counts.allocations + charged.allocations,
+            bytes_allocated: allocation_counts.bytes_allocated + charged.bytes_allocated,
+        };
+    }
+
+    void charge_usage(Usage usage) {
+        charged.cpu_seconds += usage.cpu_seconds;
+        charged.allocations += usage.allocations;
+        charged.bytes_allocated += usage.bytes_allocated;
+    }
+
+    PassTimer::PassTimer(vector<PassStats>* passes) : passes(passes) {
+        if (passes != NULL) {
+            counting.emplace();
+            start = std::chrono::steady_clock::now();
+            before = thread_usage();
+        }
+    }
+
+    void PassTimer::end(const char* name, const char* unit, uint64_t items) {
+        if (passes == NULL) {
+            return;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        Usage after = thread_usage();
+
+        passes->push_back(PassStats {
+            name: name,
+            unit: unit,
+            items: items,
+            seconds: std::chrono::duration<double>(now - start).count(),
+            cpu_seconds: after.cpu_seconds - before.cpu_seconds,
+            allocations: after.allocations - before.allocations,
+            bytes_allocated: after.bytes_allocated - before.bytes_allocated,
+        });
+
+        // Whatever it took to record this one counts towards nobody
+        start = std::chrono::steady_clock::now();
+        before = thread_usage();
+    }
+
+    uint64_t count_tokens(const char* source) {
+        uint64_t count = 0;
+        for (Token t = read_token(source); t.type != 0 && t.type != TOKEN_ERROR; t = read_token(t.end)) {
+            count++;
+        }
+
+        return count;
+    }
+
+    // Nodes as the C++ AST stores them, which is one per node of the C AST too
+    uint64_t count_nodes(const StringAST& ast) {
+        const StringArena& a = ast.arena;
+        return ast.declarations.size()
+            + a.boolean_literals.size() + a.integer_literals.size() + a.string_literals.size()
+            + a.list_literals.size() + a.binary_operations.size() + a.unary_operations.size()
+            + a.indexes.size() + a.calls.size() + a.identifiers.size()
+            + a.ifs.size() + a.whiles.size() + a.returns.size() + a.dos.size()
+            + a.assignments.size() + a.variable_declarations.size();
+    }
+
+    static uint64_t count_expression(const IndexArena& arena, ExpressionRef e);
+
+    static uint64_t count_expressions(const IndexArena& arena, ExpressionList list) {
+        uint64_t count = 0;
+        for (ExpressionRef e : arena.expressions(list)) {
+            count += count_expression(arena, e);
+        }
+
+        return count;
+    }
+
+    // Null literals aren't stored anywhere, so like count_nodes this leaves them out
+    static uint64_t count_expression(const IndexArena& arena, ExpressionRef e) {
+        return visit(arena, e, [&](auto& e) -> uint64_t {
+            using T = std::decay_t<decltype(e)>;
+            if constexpr (std::is_same_v<T, NullLiteral>) {
+                return 0;
+            } else if constexpr (std::is_same_v<T, ListLiteral>) {
+                return 1 + count_expressions(arena, e.value);
+            } else if constexpr (std::is_same_v<T, BinaryOperation>) {
+                return 1 + count_expression(arena, e.left) + count_expression(arena, e.right);
+            } else if constexpr (std::is_same_v<T, UnaryOperation>) {
+                return 1 + count_expression(arena, e.content);
+            } else if constexpr (std::is_same_v<T, Index>) {
+                return 1 + count_expression(arena, e.list) + count_expression(arena, e.number);
+            } else if constexpr (std::is_same_v<T, Call>) {
+                return 1 + count_expression(arena, e.function) + count_expressions(arena, e.args);
+            } else {
+                return 1;
+            }
+        });
+    }
+
+    static uint64_t count_statements(const IndexArena& arena, StatementList list) {
+        uint64_t count = 0;
+        for (StatementRef s : arena.statements(list)) {
+            count += 1 + visit(arena, s, [&](auto& s) -> uint64_t {
+                using T = std::decay_t<decltype(s)>;
+                if constexpr (std::is_same_v<T, If>) {
+                    uint64_t count = 0;
+                    for (const IfPair& pair : arena.pairs(s.if_pairs)) {
+                        count += count_expression(arena, pair.condition) + count_statements(arena, pair.body);
+                    }
+                    if (s.else_body) {
+                        count += count_statements(arena, *s.else_body);
+                    }
+
+                    return count;
+                } else if constexpr (std::is_same_v<T, While>) {
+                    return count_expression(arena, s.condition) + count_statements(arena, s.body);
+                } else if constexpr (std::is_same_v<T, Assignment<IndexName>>) {
+                    return count_expressions(arena, s.indexes) + count_expression(arena, s.content);
+                } else {
+                    return count_expression(arena, s.content);
+                }
+            });
+        }
+
+        return count;
+    }
+
+    uint64_t count_reachable_nodes(const IndexAST& ast) {
+        uint64_t count = ast.declarations.size();
+        for (const IndexDeclaration& decl : ast.declarations) {
+            if (const IndexFunction* function = std::get_if<IndexFunction>(&decl)) {
+                count += count_statements(ast.arena, function->body);
+            }
+        }
+
+        return count;
+    }
+
+    static void print_row(FILE* out, const PassStats& pass, bool time, bool memory) {
+        fprintf(out, "%-16s", pass.name);
+        if (time) {
+            fprintf(out, " %12.3f %12.3f", pass.seconds * 1e3, pass.cpu_seconds * 1e3);
+        }
+        if (memory) {
+            fprintf(out, " %12llu %14llu", (unsigned long long)pass.allocations, (unsigned long long)pass.bytes_allocated);
+        }
+        if (pass.unit[0] != '\0') {
+            fprintf(out, " %12llu %s", (unsigned long long)pass.items, pass.unit);
+        }
+        fputc('\n', out);
+    }
+
+    void print_passes(FILE* out, const vector<PassStats>& passes, bool time, bool memory) {
+        fprintf(out, "%-16s", "pass");
+        if (time) {
+            fprintf(out, " %12s %12s", "wall ms", "cpu ms");
+        }
+        if (memory) {
+            fprintf(out, " %12s %14s", "allocations", "bytes");
+        }
+        fprintf(out, " %12s\n", "items");
+
+        PassStats total = PassStats {
+            name: "total",
+            unit: "",
+            items: 0,
+            seconds: 0,
+            cpu_seconds: 0,
+            allocations: 0,
+            bytes_allocated: 0,
+        };
+        for (const PassStats& pass : passes) {
+            print_row(out, pass, time, memory);
+
+            total.seconds += pass.seconds;
+            total.cpu_seconds += pass.cpu_seconds;
+            total.allocations += pass.allocations;
+            total.bytes_allocated += pass.bytes_allocated;
+        }
+
+        print_row(out, total, time, memory);
+    }
+}
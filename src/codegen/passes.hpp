@@ -0,0 +1,108 @@
+#ifndef PASSES_CODEGEN
+#define PASSES_CODEGEN
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <vector>
+
+#include "ast.hpp"
+
+namespace codegen {
+    /*
+     * What `--time-passes` and `--mem-passes` report. Allocations are counted by the malloc in
+     * alloc_count.cpp, so the C parser shows up as well as everything C++ does. Only
+     * src/codegen/main and src/codegen/bench link it, and only on glibc without ASan. Everywhere
+     * else, merc included, they stay zero.
+     */
+
+    // What alloc_count.cpp's malloc adds to, for the thread doing the allocating
+    struct AllocationCounts {
+        uint64_t allocations;
+        uint64_t bytes_allocated;
+    };
+
+    // initial-exec keeps the counts from ever being allocated themselves, which would recurse
+    extern thread_local constinit __attribute__((tls_model("initial-exec"))) AllocationCounts allocation_counts;
+
+    // How many CountAllocations are alive. While it's zero, malloc doesn't count anything.
+    extern std::atomic<uint32_t> counting_allocations;
+
+    // Counts allocations on every thread for as long as it's alive
+    class CountAllocations {
+    public:
+        CountAllocations();
+        ~CountAllocations();
+
+        CountAllocations(const CountAllocations&) = delete;
+        CountAllocations& operator=(const CountAllocations&) = delete;
+    };
+
+    // What a thread has used up since it started
+    struct Usage {
+        double cpu_seconds;
+        uint64_t allocations;
+        uint64_t bytes_allocated;
+    };
+
+    // This thread's own usage, plus whatever was charged to it by threads working on its behalf
+    Usage thread_usage();
+    void charge_usage(Usage usage);
+
+    // Laid out for the glue to hand straight to Rust
+    struct PassStats {
+        const char* name;
+        // What `items` counts: tokens, bytes, nodes or instructions
+        const char* unit;
+        uint64_t items;
+        double seconds;
+        double cpu_seconds;
+        uint64_t allocations;
+        uint64_t bytes_allocated;
+    };
+
+    // Times passes that run back to back, each one from where the last ended. Without anywhere
+    // to put them it doesn't measure anything, allocations included.
+    class PassTimer {
+    public:
+        explicit PassTimer(vector<PassStats>* passes);
+
+        void end(const char* name, const char* unit, uint64_t items);
+
+        // For counts that are too slow to take when nothing's being measured. Taking them
+        // doesn't count towards this pass or the next.
+        template<typename F>
+        void end_counted(const char* name, const char* unit, F&& count) {
+            if (passes == NULL) {
+                return;
+            }
+
+            end(name, unit, 0);
+            passes->back().items = count();
+
+            start = std::chrono::steady_clock::now();
+            before = thread_usage();
+        }
+
+    private:
+        vector<PassStats>* passes;
+        std::optional<CountAllocations> counting;
+        std::chrono::steady_clock::time_point start;
+        Usage before;
+    };
+
+    // Lexes the whole source on its own, which the parser otherwise does as it goes
+    uint64_t count_tokens(const char* source);
+    uint64_t count_nodes(const StringAST& ast);
+    // Only what the declarations can still reach. Folding leaves whatever it replaced behind in
+    // the arena, so the pools alone wouldn't show what it removed.
+    uint64_t count_reachable_nodes(const IndexAST& ast);
+
+    // A table with a total at the bottom. `time` and `memory` pick the columns.
+    void print_passes(FILE* out, const vector<PassStats>& passes, bool time, bool memory);
+}
+
+#endif
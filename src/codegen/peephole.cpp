@@ -0,0 +1,384 @@
+#include <array>
+#include <optional>
+#include <variant>
+
+#include "peephole.hpp"
+
+using namespace codegen;
+
+// While the code is being rewritten, every jump and every IFunc remembers the index of the
+// instruction it points at (for an IFunc, the one just past its body). The offsets only get
+// worked out again once nothing moves anymore.
+struct Slot {
+    Instruction in;
+    size_t target;
+};
+
+// What a rule gets to look at: the instruction at `at`, and the `size - 1` after it that nothing
+// jumps into. Rules may peek at any of `code`, but only ever replace part of their window.
+struct Window {
+    const vector<Slot>& code;
+    size_t at;
+    size_t size;
+    const Interner& strings;
+
+    template<typename T>
+    const T* get(size_t i) const {
+        return i < size ? std::get_if<T>(&code[at + i].in) : nullptr;
+    }
+
+    const Slot& first() const {
+        return code[at];
+    }
+};
+
+// Appends whatever should replace the start of the window to `out`, and returns how many
+// instructions that replaces. 0 means the rule doesn't apply here.
+using Rewrite = size_t (*)(const Window& w, vector<Slot>& out);
+
+struct Rule {
+    const char* name;
+    Rewrite rewrite;
+};
+
+template<typename T>
+bool is(const Instruction& in) {
+    return std::holds_alternative<T>(in);
+}
+
+bool is_jump(const Instruction& in) {
+    return is<Jump>(in) || is<JumpIfFalse>(in) || is<Loop>(in);
+}
+
+// Pushes a value and does nothing else, so leaving it out is fine when nobody uses the value
+bool pure_push(const Instruction& in) {
+    const ListConst* list = std::get_if<ListConst>(&in);
+
+    return is<NullConst>(in) || is<BooleanConst>(in) || is<IntegerConst>(in) || is<StringConst>(in)
+        || is<GetLocal>(in) || is<GetGlobal>(in) || (list != nullptr && list->value == 0);
+}
+
+// What value.rs's truthy() will think of a constant
+std::optional<bool> truthiness(const Instruction& in, const Interner& strings) {
+    if (is<NullConst>(in)) {
+        return false;
+    } else if (const BooleanConst* b = std::get_if<BooleanConst>(&in)) {
+        return b->value;
+    } else if (const IntegerConst* i = std::get_if<IntegerConst>(&in)) {
+        return i->value != 0;
+    } else if (const StringConst* s = std::get_if<StringConst>(&in)) {
+        return !strings.get(s->value).empty();
+    } else if (const ListConst* l = std::get_if<ListConst>(&in); l != nullptr && l->value == 0) {
+        return false;
+    }
+
+    return std::nullopt;
+}
+
+/*
+ * Rules
+ */
+
+// `while (true)`, and whatever conditions fold_constants could work out
+size_t constant_condition(const Window& w, vector<Slot>& out) {
+    std::optional<bool> truthy = truthiness(w.first().in, w.strings);
+
+    if (!truthy || w.get<JumpIfFalse>(1) == nullptr) {
+        return 0;
+    }
+
+    if (!*truthy) {
+        out.push_back(Slot { in: Jump {}, target: w.code[w.at + 1].target });
+    }
+
+    return 2;
+}
+
+// Jumps to wherever the code would have gone next anyway
+size_t jump_to_next(const Window& w, vector<Slot>& out) {
+    const Slot& jump = w.first();
+
+    if (jump.target != w.at + 1 || !(is<Jump>(jump.in) || is<JumpIfFalse>(jump.in))) {
+        return 0;
+    }
+
+    // The condition still has to go
+    if (is<JumpIfFalse>(jump.in)) {
+        out.push_back(Slot { in: Drop {}, target: 0 });
+    }
+
+    return 1;
+}
+
+// A jump that lands on another jump can go straight to where that one goes
+size_t thread_jump(const Window& w, vector<Slot>& out) {
+    const Slot& jump = w.first();
+
+    if (!is_jump(jump.in) || jump.target >= w.code.size()) {
+        return 0;
+    }
+
+    const Slot& landing = w.code[jump.target];
+    if (!is<Jump>(landing.in) && !is<Loop>(landing.in)) {
+        return 0;
+    }
+
+    // JumpIfFalse only goes forwards, and jumps that end up where they started loop forever
+    // whichever way they go
+    if (landing.target == w.at || landing.target == jump.target
+        || (is<JumpIfFalse>(jump.in) && landing.target <= w.at)) {
+        return 0;
+    }
+
+    out.push_back(Slot { in: jump.in, target: landing.target });
+    return 1;
+}
+
+// A jump to a return might as well return itself. The else branch at the end of a function
+// jumps to its `return null;` like this.
+size_t jump_to_return(const Window& w, vector<Slot>& out) {
+    const Slot& jump = w.first();
+
+    if (!is<Jump>(jump.in) || jump.target + 1 >= w.code.size()) {
+        return 0;
+    }
+
+    const Slot& landing = w.code[jump.target];
+    if (is<IReturn>(landing.in)) {
+        out.push_back(landing);
+        return 1;
+    } else if (pure_push(landing.in) && is<IReturn>(w.code[jump.target + 1].in)) {
+        out.push_back(landing);
+        out.push_back(w.code[jump.target + 1]);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Nothing after a return or an unconditional jump runs, up until something jumps there
+size_t unreachable(const Window& w, vector<Slot>& out) {
+    const Instruction& in = w.first().in;
+
+    if (w.size < 2 || !(is<IReturn>(in) || is<Jump>(in) || is<Loop>(in))) {
+        return 0;
+    }
+
+    out.push_back(w.first());
+    return w.size;
+}
+
+// `do x;` and `do 1;`
+size_t drop_unused_value(const Window& w, vector<Slot>&) {
+    return pure_push(w.first().in) && w.get<Drop>(1) != nullptr ? 2 : 0;
+}
+
+// `set x = x;`
+size_t self_assignment(const Window& w, vector<Slot>&) {
+    const GetLocal* get = w.get<GetLocal>(0);
+    const SetLocal* set = w.get<SetLocal>(1);
+
+    return get != nullptr && set != nullptr && get->index.value == set->index.value ? 2 : 0;
+}
+
+// A local that's used right after it's set, like `let x = ...;` followed by anything using x
+size_t store_then_load(const Window& w, vector<Slot>& out) {
+    const SetLocal* set = w.get<SetLocal>(0);
+    const GetLocal* get = w.get<GetLocal>(1);
+
+    if (set == nullptr || get == nullptr || set->index.value != get->index.value) {
+        return 0;
+    }
+
+    out.push_back(Slot { in: TeeLocal { index: set->index }, target: 0 });
+    return 2;
+}
+
+// What store_then_load leaves behind when the use was `do x;`
+size_t tee_then_drop(const Window& w, vector<Slot>& out) {
+    const TeeLocal* tee = w.get<TeeLocal>(0);
+
+    if (tee == nullptr || w.get<Drop>(1) == nullptr) {
+        return 0;
+    }
+
+    out.push_back(Slot { in: SetLocal { index: tee->index }, target: 0 });
+    return 2;
+}
+
+// Tried in order, the first one that applies wins
+static const std::array<Rule, 9> rules = {
+    Rule { name: "constant_condition", rewrite: constant_condition },
+    Rule { name: "jump_to_next", rewrite: jump_to_next },
+    Rule { name: "thread_jump", rewrite: thread_jump },
+    Rule { name: "jump_to_return", rewrite: jump_to_return },
+    Rule { name: "unreachable", rewrite: unreachable },
+    Rule { name: "drop_unused_value", rewrite: drop_unused_value },
+    Rule { name: "self_assignment", rewrite: self_assignment },
+    Rule { name: "store_then_load", rewrite: store_then_load },
+    Rule { name: "tee_then_drop", rewrite: tee_then_drop },
+};
+
+// Every sweep either shrinks the code or moves a jump closer to where it ends up, so this is
+// only here to keep something pathological from going on for too long
+static const int max_sweeps = 16;
+
+/*
+ * Driver
+ */
+
+vector<Slot> to_slots(const Instructions& ins) {
+    vector<Slot> code;
+    code.reserve(ins.size());
+
+    for (size_t i = 0; i < ins.size(); i++) {
+        size_t target = std::visit([&](auto& in) -> size_t {
+            using T = std::decay_t<decltype(in)>;
+            if constexpr (std::is_same_v<T, Jump> || std::is_same_v<T, JumpIfFalse>) {
+                return i + in.offset.value;
+            } else if constexpr (std::is_same_v<T, Loop>) {
+                return i - in.offset.value;
+            } else if constexpr (std::is_same_v<T, IFunc>) {
+                return i + 1 + in.code_size;
+            } else {
+                return 0;
+            }
+        }, ins[i]);
+
+        code.push_back(Slot { in: ins[i], target: target });
+    }
+
+    return code;
+}
+
+Instructions from_slots(const vector<Slot>& code) {
+    Instructions ins;
+    ins.reserve(code.size());
+
+    for (size_t i = 0; i < code.size(); i++) {
+        const Slot& slot = code[i];
+
+        if (is<Jump>(slot.in) || is<Loop>(slot.in)) {
+            // Threading can turn a jump around
+            if (slot.target > i) {
+                ins.push_back(Jump { offset: JumpOffset { value: slot.target - i } });
+            } else {
+                ins.push_back(Loop { offset: JumpOffset { value: i - slot.target } });
+            }
+        } else if (is<JumpIfFalse>(slot.in)) {
+            ins.push_back(JumpIfFalse { offset: JumpOffset { value: slot.target - i } });
+        } else if (const IFunc* func = std::get_if<IFunc>(&slot.in)) {
+            IFunc resized = *func;
+            resized.code_size = slot.target - i - 1;
+            ins.push_back(resized);
+        } else {
+            ins.push_back(slot.in);
+        }
+    }
+
+    return ins;
+}
+
+// Where windows have to stop: anywhere a jump lands, and where each function starts and ends
+vector<bool> boundaries(const vector<Slot>& code) {
+    vector<bool> marked(code.size() + 1, false);
+
+    for (size_t i = 0; i < code.size(); i++) {
+        if (is_jump(code[i].in)) {
+            marked[code[i].target] = true;
+        } else if (is<IFunc>(code[i].in)) {
+            marked[i] = true;
+            marked[code[i].target] = true;
+        }
+    }
+
+    return marked;
+}
+
+// Tries every rule once at every instruction, and returns whether any of them fired
+bool sweep(vector<Slot>& code, const Interner& strings, PeepholeStats& stats) {
+    vector<bool> marked = boundaries(code);
+
+    // How far a window starting at each instruction reaches
+    vector<size_t> window_end(code.size());
+    for (size_t i = code.size(), end = code.size(); i-- > 0;) {
+        window_end[i] = end;
+        if (marked[i]) {
+            end = i;
+        }
+    }
+
+    vector<Slot> out;
+    out.reserve(code.size());
+
+    // Where each instruction went, so jumps can follow it. Whatever a rule removed maps to what
+    // replaced it, or to whatever came after if nothing did.
+    vector<size_t> moved(code.size() + 1);
+
+    vector<Slot> replacement;
+    bool changed = false;
+
+    size_t i = 0;
+    while (i < code.size()) {
+        const Window w = Window { code: code, at: i, size: window_end[i] - i, strings: strings };
+
+        size_t replaced = 0;
+        for (size_t r = 0; r < rules.size() && replaced == 0; r++) {
+            replacement.clear();
+            replaced = rules[r].rewrite(w, replacement);
+
+            if (replaced > 0) {
+                stats[r].fired++;
+            }
+        }
+
+        if (replaced == 0) {
+            moved[i] = out.size();
+            out.push_back(code[i]);
+            i++;
+            continue;
+        }
+
+        for (size_t j = i; j < i + replaced; j++) {
+            moved[j] = out.size();
+        }
+
+        out.insert(out.end(), replacement.begin(), replacement.end());
+        i += replaced;
+        changed = true;
+    }
+
+    moved[code.size()] = out.size();
+
+    for (Slot& slot : out) {
+        if (is_jump(slot.in) || is<IFunc>(slot.in)) {
+            slot.target = moved[slot.target];
+        }
+    }
+
+    code = std::move(out);
+    return changed;
+}
+
+namespace codegen {
+    PeepholeStats peephole(Program& program) {
+        PeepholeStats stats;
+        for (const Rule& rule : rules) {
+            stats.push_back(RuleCount { rule: rule.name, fired: 0 });
+        }
+
+        vector<Slot> code = to_slots(program.instructions);
+        for (int i = 0; i < max_sweeps && sweep(code, program.strings, stats); i++) {}
+
+        program.instructions = from_slots(code);
+
+        return stats;
+    }
+
+    void print_peephole_stats(FILE* out, const PeepholeStats& stats) {
+        fprintf(out, "%-20s %12s\n", "rule", "fired");
+        for (const RuleCount& count : stats) {
+            fprintf(out, "%-20s %12llu\n", count.rule, (unsigned long long)count.fired);
+        }
+    }
+}
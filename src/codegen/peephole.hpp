@@ -0,0 +1,28 @@
+#ifndef PEEPHOLE_CODEGEN
+#define PEEPHOLE_CODEGEN
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "instructions.hpp"
+
+namespace codegen {
+    struct RuleCount {
+        const char* rule;
+        uint64_t fired;
+    };
+
+    // One per rule, in the order the table tries them
+    using PeepholeStats = vector<RuleCount>;
+
+    // Rewrites short runs of instructions into cheaper ones until none of the rules apply
+    // anymore, keeping every jump and function pointed at the same code. Runs after
+    // instructionify at -O1 and up.
+    PeepholeStats peephole(Program& program);
+
+    void print_peephole_stats(FILE* out, const PeepholeStats& stats);
+}
+
+#endif
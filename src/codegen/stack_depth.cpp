@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <optional>
+#include <variant>
+
+#include "stack_depth.hpp"
+
+using namespace codegen;
+
+template<class> inline constexpr bool always_false_v = false;
+
+std::monostate panic4() {
+    *(int*)0 = 0;
+    return std::monostate {};
+}
+
+// How many values an instruction takes off the stack, and how many it puts back. These are the
+// `[...] -> ...` comments in instructions.hpp.
+struct StackEffect {
+    uint64_t pops;
+    uint64_t pushes;
+};
+
+StackEffect stack_effect(const Instruction& in) {
+    return std::visit([](auto& in) -> StackEffect {
+        using T = std::decay_t<decltype(in)>;
+        if constexpr (std::is_same_v<T, IFunc> || std::is_same_v<T, Jump> || std::is_same_v<T, Loop>) {
+            return StackEffect { pops: 0, pushes: 0 };
+        } else if constexpr (std::is_same_v<T, IImport> || std::is_same_v<T, IReturn>
+                             || std::is_same_v<T, SetLocal> || std::is_same_v<T, Drop>
+                             || std::is_same_v<T, JumpIfFalse> || std::is_same_v<T, IGlobal>
+                             || std::is_same_v<T, SetGlobal>) {
+            return StackEffect { pops: 1, pushes: 0 };
+        } else if constexpr (std::is_same_v<T, CallKnown> || std::is_same_v<T, CallDirect>) {
+            return StackEffect { pops: in.arg_count.value, pushes: 1 };
+        } else if constexpr (std::is_same_v<T, CallUnknown>) {
+            return StackEffect { pops: in.arg_count.value + 1, pushes: 1 };
+        } else if constexpr (std::is_same_v<T, NullConst> || std::is_same_v<T, BooleanConst>
+                             || std::is_same_v<T, IntegerConst> || std::is_same_v<T, StringConst>
+                             || std::is_same_v<T, GetLocal> || std::is_same_v<T, GetGlobal>) {
+            return StackEffect { pops: 0, pushes: 1 };
+        } else if constexpr (std::is_same_v<T, ListConst>) {
+            return StackEffect { pops: in.value, pushes: 1 };
+        } else if constexpr (std::is_same_v<T, TeeLocal> || std::is_same_v<T, GetFree>
+                             || std::is_same_v<T, INegate> || std::is_same_v<T, INot>) {
+            return StackEffect { pops: 1, pushes: 1 };
+        } else if constexpr (std::is_same_v<T, SetFree>) {
+            return StackEffect { pops: 2, pushes: 0 };
+        } else if constexpr (std::is_same_v<T, IAdd> || std::is_same_v<T, ISub>
+                             || std::is_same_v<T, IMul> || std::is_same_v<T, IDiv>
+                             || std::is_same_v<T, IMod> || std::is_same_v<T, IEq>
+                             || std::is_same_v<T, INe> || std::is_same_v<T, ILt>
+                             || std::is_same_v<T, ILe> || std::is_same_v<T, IGt>
+                             || std::is_same_v<T, IGe> || std::is_same_v<T, IAnd>
+                             || std::is_same_v<T, IOr> || std::is_same_v<T, IIndex>) {
+            return StackEffect { pops: 2, pushes: 1 };
+        } else if constexpr (std::is_same_v<T, IIndexSet>) {
+            return StackEffect { pops: 3, pushes: 0 };
+        } else {
+            static_assert(always_false_v<T>, "non-exhaustive visitor!");
+        }
+    }, in);
+}
+
+// Where the code can go once the instruction at `at` is done. Returns go nowhere, and a function
+// definition goes past its body.
+void successors(const Instructions& ins, size_t at, vector<size_t>& out) {
+    out.clear();
+
+    const Instruction& in = ins[at];
+    if (const Jump* jump = std::get_if<Jump>(&in)) {
+        out.push_back(at + jump->offset.value);
+    } else if (const JumpIfFalse* jump = std::get_if<JumpIfFalse>(&in)) {
+        out.push_back(at + 1);
+        out.push_back(at + jump->offset.value);
+    } else if (const Loop* loop = std::get_if<Loop>(&in)) {
+        out.push_back(at - loop->offset.value);
+    } else if (const IFunc* func = std::get_if<IFunc>(&in)) {
+        out.push_back(at + 1 + func->code_size);
+    } else if (!std::holds_alternative<IReturn>(in)) {
+        out.push_back(at + 1);
+    }
+}
+
+// Follows every path through [start, end) from `start`, where nothing is on the stack yet, and
+// returns the most that's ever on it. Function bodies can only be left by returning, the top
+// level only by running off the end with nothing left on the stack.
+uint64_t max_depth(const Instructions& ins, size_t start, size_t end, bool in_function) {
+    // How much is on the stack before each instruction, once some path has gotten there
+    vector<std::optional<uint64_t>> before(end - start);
+    vector<size_t> work;
+    vector<size_t> next;
+    uint64_t deepest = 0;
+
+    if (start == end) {
+        if (in_function) {
+            panic4();
+        }
+
+        return 0;
+    }
+
+    before[0] = 0;
+    work.push_back(start);
+
+    while (!work.empty()) {
+        size_t at = work.back();
+        work.pop_back();
+
+        uint64_t depth = *before[at - start];
+        StackEffect effect = stack_effect(ins[at]);
+
+        if (effect.pops > depth) {
+            panic4();
+        }
+
+        // Whatever the return leaves is what the caller gets, nothing more
+        if (std::holds_alternative<IReturn>(ins[at]) && depth != 1) {
+            panic4();
+        }
+
+        uint64_t after = depth - effect.pops + effect.pushes;
+        deepest = std::max(deepest, after);
+
+        successors(ins, at, next);
+        for (size_t to : next) {
+            if (to == end && !in_function && after == 0) {
+                continue;
+            }
+
+            // Anywhere else out of bounds is a jump that went wrong. A Loop that went back too
+            // far wrapped around, so it ends up here too.
+            if (to < start || to >= end) {
+                panic4();
+            }
+
+            std::optional<uint64_t>& seen = before[to - start];
+            if (!seen) {
+                seen = after;
+                work.push_back(to);
+            } else if (*seen != after) {
+                panic4();
+            }
+        }
+    }
+
+    return deepest;
+}
+
+namespace codegen {
+    void compute_stack_depths(Program& program) {
+        Instructions& ins = program.instructions;
+
+        max_depth(ins, 0, ins.size(), false);
+
+        for (size_t i = 0; i < ins.size(); i++) {
+            if (IFunc* func = std::get_if<IFunc>(&ins[i])) {
+                func->max_stack = max_depth(ins, i + 1, i + 1 + func->code_size, true);
+            }
+        }
+    }
+}
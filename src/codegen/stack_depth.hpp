@@ -0,0 +1,16 @@
+#ifndef STACK_DEPTH_CODEGEN
+#define STACK_DEPTH_CODEGEN
+
+#include "instructions.hpp"
+
+namespace codegen {
+    // Works out how deep each function gets into the value stack, from the stack effects noted on
+    // each instruction, and stores it in the function's IFunc. Along the way it checks that every
+    // path agrees on the depth wherever paths meet, that nothing pops what isn't there, and that
+    // returns leave exactly the returned value behind, which is what lets the runtime skip
+    // cleaning up after a call. Code that breaks any of that is a codegen bug, and panics.
+    // Runs last, after the peephole pass.
+    void compute_stack_depths(Program& program);
+}
+
+#endif
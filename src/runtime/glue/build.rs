@@ -39,8 +39,14 @@ fn main() {
         .flag("-Wno-sign-compare")
         .files([
             in_codegen("ast.cpp"),
+            in_codegen("bytecode.cpp"),
+            in_codegen("fold.cpp"),
+            in_codegen("peephole.cpp"),
             in_codegen("instructions.cpp"),
+            in_codegen("interner.cpp"),
             in_codegen("middle_end.cpp"),
+            in_codegen("passes.cpp"),
+            in_codegen("stack_depth.cpp"),
         ])
         .compile("merccodegen");
 
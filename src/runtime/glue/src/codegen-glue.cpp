@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstring>
 #include <variant>
 
@@ -12,15 +13,19 @@ extern "C" {
 
 
 #include "../../../codegen/ast.hpp"
+#include "../../../codegen/bytecode.hpp"
+#include "../../../codegen/fold.hpp"
 #include "../../../codegen/instructions.hpp"
+#include "../../../codegen/interner.hpp"
 #include "../../../codegen/middle_end.hpp"
+#include "../../../codegen/passes.hpp"
+#include "../../../codegen/peephole.hpp"
+#include "../../../codegen/stack_depth.hpp"
 
 #pragma GCC diagnostic pop
 
 #define IIMPORT 0
 #define IFUNC 1
-#define START_BLOCK 2
-#define END_BLOCK 3
 #define IRETURN 4
 #define CALL_KNOWN 5
 #define CALL_UNKNOWN 6
@@ -32,27 +37,56 @@ extern "C" {
 #define GET_LOCAL 12
 #define SET_LOCAL 13
 #define DROP 14
-#define IIF 15
 #define LOOP 16
-#define BREAK_IF 17
 #define IGLOBAL 18
 #define GET_FREE 19
 #define SET_FREE 20
+#define GET_GLOBAL 21
+#define SET_GLOBAL 22
+#define ADD 23
+#define SUB 24
+#define MUL 25
+#define DIV 26
+#define MOD 27
+#define EQ 28
+#define NE 29
+#define LT 30
+#define LE 31
+#define GT 32
+#define GE 33
+#define AND 34
+#define OR 35
+#define NEGATE 36
+#define NOT 37
+#define INDEX 38
+#define INDEX_SET 39
+#define JUMP 40
+#define JUMP_IF_FALSE 41
+#define TEE_LOCAL 42
+#define CALL_DIRECT 43
 
 struct IFunc {
     uint64_t parm_count;
-    char const* ident;
+    uint32_t ident;
+    uint64_t code_size;
+    uint64_t frame_size;
+    uint64_t max_stack;
 };
 
 struct CallKnown {
     uint64_t arg_count;
-    char const* ident;
+    uint32_t ident;
 };
 
 struct CallUnknown {
     uint64_t arg_count;
 };
 
+struct CallDirect {
+    uint64_t arg_count;
+    uint64_t callee;
+};
+
 struct BooleanConst {
     bool value;   
 };
@@ -62,7 +96,7 @@ struct IntegerConst {
 };
 
 struct StringConst {
-    char const* value;
+    uint32_t value;
 };
 
 struct ListConst {
@@ -77,18 +111,49 @@ struct SetLocal {
     uint64_t index;
 };
 
+struct TeeLocal {
+    uint64_t index;
+};
+
+struct GetGlobal {
+    uint64_t index;
+};
+
+struct SetGlobal {
+    uint64_t index;
+};
+
+struct Jump {
+    uint64_t offset;
+};
+
+struct JumpIfFalse {
+    uint64_t offset;
+};
+
+struct Loop {
+    uint64_t offset;
+};
+
 
 union Instruction {
     void const* dummy;
     IFunc ifunc;
     CallKnown call_known;
     CallUnknown call_unknown;
+    CallDirect call_direct;
     BooleanConst boolean_const;
     IntegerConst integer_const;
     StringConst string_const;
     ListConst list_const;
     GetLocal get_local;
     SetLocal set_local;
+    TeeLocal tee_local;
+    GetGlobal get_global;
+    SetGlobal set_global;
+    Jump jump;
+    JumpIfFalse jump_if_false;
+    Loop loop;
 };
 
 struct InstructionAndTag {
@@ -96,23 +161,142 @@ struct InstructionAndTag {
     uint8_t tag;
 };
 
+// Points into the Interner that owns the string, not null terminated
+struct StringRef {
+    char const* data;
+    uint64_t len;
+};
+
+// Identifiers and string constants are indexes into `strings`, which is only valid until the
+// Instructions are freed. `globals` maps this file's global slots to the names they belong to.
 struct Instructions {
     InstructionAndTag* insns;
     uint32_t size;
+    StringRef const* strings;
+    uint32_t string_count;
+    uint32_t const* globals;
+    uint32_t global_count;
+    void* owner;
+};
+
+// What the threaded engine runs: a whole codegen::write_image image, exactly as `codegen/main -o`
+// would have written it to disk
+struct Image {
+    uint8_t const* data;
+    uint64_t size;
+    void* owner;
+};
+
+// How to compile, mirrors glue::Options. `jobs` is how many threads the codegen may lower
+// functions on, `opt_level` is codegen/main's -O.
+struct CompileOptions {
+    uint32_t jobs;
+    uint32_t opt_level;
 };
 
-static auto MercenaryTranslateCodegenInstructionsToGoodInstructions(codegen::Instructions Insns) noexcept -> Instructions;
+// What each pass of compiling one file took, filled in when whoever compiles it asks for them
+struct PassList {
+    codegen::PassStats const* passes;
+    uint32_t count;
+    void* owner;
+};
+
+// The paths a file imports, in order, pointing into the source they were scanned from
+struct ImportList {
+    StringRef const* paths;
+    uint32_t count;
+};
+
+static auto MercenaryTranslateCodegenInstructionsToGoodInstructions(codegen::Program* Program) noexcept -> Instructions;
+static auto MercenaryCompile(char const* Source, uint32_t Length, CompileOptions Options, std::vector<codegen::PassStats>* Passes) -> codegen::Program;
+static auto MercenaryPassList(std::vector<codegen::PassStats>* Passes) -> PassList;
+static auto MercenaryStringRefs(codegen::Interner const& Strings) -> StringRef*;
 
 extern "C" auto MercenaryFreeInstructions(Instructions Insns) noexcept -> void {
-    for (uint32_t i = 0; i < Insns.size; i++) {
-        if (Insns.insns[i].tag == STRING_CONST) delete Insns.insns[i].insn.string_const.value;
-        if (Insns.insns[i].tag == CALL_KNOWN) delete Insns.insns[i].insn.call_known.ident;
-        if (Insns.insns[i].tag == IFUNC) delete Insns.insns[i].insn.ifunc.ident;
+    delete[] Insns.insns;
+    delete[] Insns.strings;
+    delete static_cast<codegen::Program*>(Insns.owner);
+}
+
+extern "C" auto MercenaryFreeImage(Image Image) noexcept -> void {
+    delete static_cast<std::string*>(Image.owner);
+}
+
+extern "C" auto MercenaryFreeImports(ImportList Imports) noexcept -> void {
+    delete[] Imports.paths;
+}
+
+extern "C" auto MercenaryFreePasses(PassList Passes) noexcept -> void {
+    delete static_cast<std::vector<codegen::PassStats>*>(Passes.owner);
+}
+
+// Only runs the lexer, so the import graph can be walked without parsing anything
+extern "C" auto MercenaryScanImports(char const* Source, uint32_t Length) -> ImportList {
+    std::vector<StringRef> paths;
+    char const* end = Source + Length;
+
+    for (Token t = read_token(Source); t.type != 0 && t.type != TOKEN_ERROR && t.end <= end; t = read_token(t.end)) {
+        if (t.type == TOKEN_IMPORT) {
+            Token path = read_token(t.end);
+            if (path.type == TOKEN_STRING) {
+                // Without the quotes
+                paths.push_back(StringRef { .data = path.start + 1, .len = static_cast<uint64_t>(path.end - path.start - 2) });
+                t = path;
+            }
+        }
+    }
+
+    auto* list = new StringRef[paths.size()];
+    std::copy(paths.begin(), paths.end(), list);
+
+    return ImportList { .paths = list, .count = static_cast<uint32_t>(paths.size()) };
+}
+
+// Each pass gets timed into `Passes` unless it's null
+extern "C" auto MercenaryGetInstructionFromString(char const* Source, uint32_t Length, CompileOptions Options, PassList* Passes) -> Instructions {
+    auto* passes = Passes != nullptr ? new std::vector<codegen::PassStats>() : nullptr;
+    auto* program = new codegen::Program(MercenaryCompile(Source, Length, Options, passes));
+
+    codegen::PassTimer timer(passes);
+    auto instructions = MercenaryTranslateCodegenInstructionsToGoodInstructions(program);
+    timer.end("glue", "instructions", instructions.size);
+
+    if (Passes != nullptr) {
+        *Passes = MercenaryPassList(passes);
+    }
+
+    return instructions;
+}
+
+extern "C" auto MercenaryGetImageFromString(char const* Source, uint32_t Length, CompileOptions Options, PassList* Passes) -> Image {
+    auto* passes = Passes != nullptr ? new std::vector<codegen::PassStats>() : nullptr;
+    auto program = MercenaryCompile(Source, Length, Options, passes);
+
+    codegen::PassTimer timer(passes);
+    auto const bytecode = codegen::encode(program);
+    timer.end("encode", "instructions", program.instructions.size());
+
+    auto* image = new std::string(codegen::write_image(program, bytecode));
+    timer.end("write_image", "bytes", image->size());
+
+    if (Passes != nullptr) {
+        *Passes = MercenaryPassList(passes);
     }
-    delete Insns.insns;
+
+    return Image {
+        .data = reinterpret_cast<uint8_t const*>(image->data()),
+        .size = image->size(),
+        .owner = image,
+    };
 }
 
-extern "C" auto MercenaryGetInstructionFromString(char const* Source, uint32_t Length) -> Instructions {
+static auto MercenaryCompile(char const* Source, uint32_t Length, CompileOptions Options, std::vector<codegen::PassStats>* Passes) -> codegen::Program {
+    codegen::PassTimer timer(Passes);
+
+    if (Passes != nullptr) {
+        timer.end("lex", "tokens", codegen::count_tokens(Source));
+    }
+
     program_t program;
 
     eh_data_t eh = {
@@ -128,11 +312,49 @@ extern "C" auto MercenaryGetInstructionFromString(char const* Source, uint32_t L
         std::abort();
     }
 
+    timer.end("parse_program", "bytes", Length);
+
     codegen::StringAST const ast = codegen::to_cpp_ast(&program);
-    codegen::IndexAST const iast = codegen::de_bruijnify(ast);
-    codegen::Instructions const insns = codegen::instructionify(iast);
+    timer.end("to_cpp_ast", "nodes", codegen::count_nodes(ast));
+
+    codegen::IndexAST iast = codegen::de_bruijnify(ast, Options.jobs);
+    timer.end("de_bruijnify", "nodes", codegen::count_nodes(ast));
+
+    if (Options.opt_level >= 1) {
+        codegen::fold_constants(iast);
+        timer.end_counted("fold_constants", "nodes", [&]() { return codegen::count_reachable_nodes(iast); });
+    }
+
+    auto compiled = codegen::instructionify(iast, Options.jobs);
+    timer.end("instructionify", "instructions", compiled.instructions.size());
 
-    return MercenaryTranslateCodegenInstructionsToGoodInstructions(std::move(insns));
+    if (Options.opt_level >= 1) {
+        codegen::peephole(compiled);
+        timer.end("peephole", "instructions", compiled.instructions.size());
+    }
+
+    codegen::compute_stack_depths(compiled);
+    timer.end("stack_depths", "instructions", compiled.instructions.size());
+
+    return compiled;
+}
+
+static auto MercenaryPassList(std::vector<codegen::PassStats>* Passes) -> PassList {
+    return PassList {
+        .passes = Passes->data(),
+        .count = static_cast<uint32_t>(Passes->size()),
+        .owner = Passes,
+    };
+}
+
+static auto MercenaryStringRefs(codegen::Interner const& Strings) -> StringRef* {
+    auto* strings = new StringRef[Strings.size()];
+    for (uint32_t i = 0; i < Strings.size(); i++) {
+        auto const& string = Strings.get(i);
+        strings[i] = StringRef { .data = string.data(), .len = string.size() };
+    }
+
+    return strings;
 }
 
 struct Visitor {
@@ -144,34 +366,18 @@ struct Visitor {
     }
 
     auto operator()(codegen::IFunc const& ifunc) {
-        auto size = ifunc.ident.value->size();
-        auto* string = new char[size + 1];
-        std::memcpy(string, ifunc.ident.value->data(), ifunc.ident.value->size());
-        string[size] = '\0';
-
         return InstructionAndTag {
             .insn = Instruction { .ifunc = IFunc {
                 .parm_count = ifunc.parm_count.value,
-                .ident = string,
+                .ident = ifunc.ident.value,
+                .code_size = ifunc.code_size,
+                .frame_size = ifunc.frame_size,
+                .max_stack = ifunc.max_stack,
             }},
             .tag = IFUNC,
         };
     }
 
-    auto operator()(codegen::StartBlock const&) {
-        return InstructionAndTag {
-            .insn = Instruction { .dummy = nullptr, },
-            .tag = START_BLOCK,
-        };
-    }
-
-    auto operator()(codegen::EndBlock const&) {
-        return InstructionAndTag {
-            .insn = Instruction { .dummy = nullptr, },
-            .tag = END_BLOCK,
-        };
-    }
-
     auto operator()(codegen::IReturn const&) {
         return InstructionAndTag {
             .insn = Instruction { .dummy = nullptr, },
@@ -180,15 +386,10 @@ struct Visitor {
     }
 
     auto operator()(codegen::CallKnown const& ck) {
-        auto str_size = ck.ident.value->size();
-        auto* ident = new char[str_size + 1];
-        std::memcpy(ident, ck.ident.value->data(), ck.ident.value->size());
-        ident[str_size] = '\0';
-
         return InstructionAndTag {
             .insn = Instruction { .call_known = CallKnown {
                 .arg_count = ck.arg_count.value,
-                .ident = ident,
+                .ident = ck.ident.value,
             }},
             .tag = CALL_KNOWN,
         };
@@ -203,6 +404,16 @@ struct Visitor {
         };
     }
 
+    auto operator()(codegen::CallDirect const& cd) {
+        return InstructionAndTag {
+            .insn = Instruction { .call_direct = CallDirect {
+                .arg_count = cd.arg_count.value,
+                .callee = cd.callee.value,
+            }},
+            .tag = CALL_DIRECT,
+        };
+    }
+
     auto operator()(codegen::NullConst const&) {
         return InstructionAndTag {
             .insn = Instruction { .dummy = nullptr, },
@@ -225,13 +436,8 @@ struct Visitor {
     }
     
     auto operator()(codegen::StringConst const& sc) {
-        auto size = sc.value->size();
-        auto* string_copy = new char[size];
-        std::memcpy(string_copy, sc.value->data(), sc.value->size());
-        string_copy[size] = '\0';
-
         return InstructionAndTag {
-            .insn = Instruction { .string_const = StringConst { .value = string_copy } },
+            .insn = Instruction { .string_const = StringConst { .value = sc.value } },
             .tag = STRING_CONST,
         };
 
@@ -258,6 +464,13 @@ struct Visitor {
         };
     }
     
+    auto operator()(codegen::TeeLocal const& tl) {
+        return InstructionAndTag {
+            .insn = Instruction { .tee_local = TeeLocal { .index = tl.index.value } },
+            .tag = TEE_LOCAL,
+        };
+    }
+    
     auto operator()(codegen::Drop const&) {
         return InstructionAndTag {
             .insn = Instruction { .dummy = nullptr, },
@@ -265,24 +478,24 @@ struct Visitor {
         };
     }
     
-    auto operator()(codegen::IIf const&) {
+    auto operator()(codegen::Jump const& j) {
         return InstructionAndTag {
-            .insn = Instruction { .dummy = nullptr, },
-            .tag = IIF,
+            .insn = Instruction { .jump = Jump { .offset = j.offset.value } },
+            .tag = JUMP,
         };
     }
     
-    auto operator()(codegen::Loop const&) {
+    auto operator()(codegen::JumpIfFalse const& jif) {
         return InstructionAndTag {
-            .insn = Instruction { .dummy = nullptr, },
-            .tag = LOOP,
+            .insn = Instruction { .jump_if_false = JumpIfFalse { .offset = jif.offset.value } },
+            .tag = JUMP_IF_FALSE,
         };
     }
     
-    auto operator()(codegen::BreakIf const&) {
+    auto operator()(codegen::Loop const& l) {
         return InstructionAndTag {
-            .insn = Instruction { .dummy = nullptr, },
-            .tag = BREAK_IF,
+            .insn = Instruction { .loop = Loop { .offset = l.offset.value } },
+            .tag = LOOP,
         };
     }
     
@@ -306,9 +519,145 @@ struct Visitor {
             .tag = SET_FREE,
         };
     }
+
+    auto operator()(codegen::GetGlobal const& gg) {
+        return InstructionAndTag {
+            .insn = Instruction { .get_global = GetGlobal { .index = gg.index.value } },
+            .tag = GET_GLOBAL,
+        };
+    }
+
+    auto operator()(codegen::SetGlobal const& sg) {
+        return InstructionAndTag {
+            .insn = Instruction { .set_global = SetGlobal { .index = sg.index.value } },
+            .tag = SET_GLOBAL,
+        };
+    }
+
+    auto operator()(codegen::IAdd const&) {
+        return InstructionAndTag {
+            .insn = Instruction { .dummy = nullptr, },
+            .tag = ADD,
+        };
+    }
+
+    auto operator()(codegen::ISub const&) {
+        return InstructionAndTag {
+            .insn = Instruction { .dummy = nullptr, },
+            .tag = SUB,
+        };
+    }
+
+    auto operator()(codegen::IMul const&) {
+        return InstructionAndTag {
+            .insn = Instruction { .dummy = nullptr, },
+            .tag = MUL,
+        };
+    }
+
+    auto operator()(codegen::IDiv const&) {
+        return InstructionAndTag {
+            .insn = Instruction { .dummy = nullptr, },
+            .tag = DIV,
+        };
+    }
+
+    auto operator()(codegen::IMod const&) {
+        return InstructionAndTag {
+            .insn = Instruction { .dummy = nullptr, },
+            .tag = MOD,
+        };
+    }
+
+    auto operator()(codegen::IEq const&) {
+        return InstructionAndTag {
+            .insn = Instruction { .dummy = nullptr, },
+            .tag = EQ,
+        };
+    }
+
+    auto operator()(codegen::INe const&) {
+        return InstructionAndTag {
+            .insn = Instruction { .dummy = nullptr, },
+            .tag = NE,
+        };
+    }
+
+    auto operator()(codegen::ILt const&) {
+        return InstructionAndTag {
+            .insn = Instruction { .dummy = nullptr, },
+            .tag = LT,
+        };
+    }
+
+    auto operator()(codegen::ILe const&) {
+        return InstructionAndTag {
+            .insn = Instruction { .dummy = nullptr, },
+            .tag = LE,
+        };
+    }
+
+    auto operator()(codegen::IGt const&) {
+        return InstructionAndTag {
+            .insn = Instruction { .dummy = nullptr, },
+            .tag = GT,
+        };
+    }
+
+    auto operator()(codegen::IGe const&) {
+        return InstructionAndTag {
+            .insn = Instruction { .dummy = nullptr, },
+            .tag = GE,
+        };
+    }
+
+    auto operator()(codegen::IAnd const&) {
+        return InstructionAndTag {
+            .insn = Instruction { .dummy = nullptr, },
+            .tag = AND,
+        };
+    }
+
+    auto operator()(codegen::IOr const&) {
+        return InstructionAndTag {
+            .insn = Instruction { .dummy = nullptr, },
+            .tag = OR,
+        };
+    }
+
+    auto operator()(codegen::INegate const&) {
+        return InstructionAndTag {
+            .insn = Instruction { .dummy = nullptr, },
+            .tag = NEGATE,
+        };
+    }
+
+    auto operator()(codegen::INot const&) {
+        return InstructionAndTag {
+            .insn = Instruction { .dummy = nullptr, },
+            .tag = NOT,
+        };
+    }
+
+    auto operator()(codegen::IIndex const&) {
+        return InstructionAndTag {
+            .insn = Instruction { .dummy = nullptr, },
+            .tag = INDEX,
+        };
+    }
+
+    auto operator()(codegen::IIndexSet const&) {
+        return InstructionAndTag {
+            .insn = Instruction { .dummy = nullptr, },
+            .tag = INDEX_SET,
+        };
+    }
 };
 
-static auto MercenaryTranslateCodegenInstructionsToGoodInstructions(codegen::Instructions Insns) noexcept -> Instructions try {
+static auto MercenaryTranslateCodegenInstructionsToGoodInstructions(codegen::Program* Program) noexcept -> Instructions try {
+    auto const& Insns = Program->instructions;
+    auto const* Strings = &Program->strings;
+
     auto* insns = new InstructionAndTag[Insns.size()];
     uint32_t k = 0;
     for (auto const& insn : Insns) {
@@ -319,6 +668,11 @@ static auto MercenaryTranslateCodegenInstructionsToGoodInstructions(codegen::Ins
     return Instructions {
         .insns = insns,
         .size = k,
+        .strings = MercenaryStringRefs(*Strings),
+        .string_count = static_cast<uint32_t>(Strings->size()),
+        .globals = Program->globals.data(),
+        .global_count = static_cast<uint32_t>(Program->globals.size()),
+        .owner = Program,
     };
 } catch (std::bad_alloc const& ex) {
     std::fprintf(stderr, "[GLUE] plz buy more wam");
@@ -7,6 +7,65 @@ use std::{ffi::c_void, os::raw::c_char};
 pub struct Instructions {
     pub insns: *mut InstructionAndTag,
     pub size: u32,
+    pub strings: *const StringRef,
+    pub string_count: u32,
+    pub globals: *const u32,
+    pub global_count: u32,
+    pub owner: *mut c_void,
+}
+
+/// glue::Options, as the codegen takes it
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct CompileOptions {
+    pub jobs: u32,
+    pub opt_level: u32,
+}
+
+/// A bytecode image, in the same format `codegen/main -o` writes, see runtime::image
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct Image {
+    pub data: *const u8,
+    pub size: u64,
+    pub owner: *mut c_void,
+}
+
+/// Not null terminated, borrowed from the codegen's interner until the Instructions are freed
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct StringRef {
+    pub data: *const c_char,
+    pub len: u64,
+}
+
+/// Points into the source that was scanned, which has to outlive it
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct ImportList {
+    pub paths: *const StringRef,
+    pub count: u32,
+}
+
+/// codegen::PassStats, owned by the codegen until it's freed
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct PassStats {
+    pub name: *const c_char,
+    pub unit: *const c_char,
+    pub items: u64,
+    pub seconds: f64,
+    pub cpu_seconds: f64,
+    pub allocations: u64,
+    pub bytes_allocated: u64,
+}
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct PassList {
+    pub passes: *const PassStats,
+    pub count: u32,
+    pub owner: *mut c_void,
 }
 
 #[repr(C)]
@@ -23,18 +82,23 @@ pub union Instruction {
     pub ifunc: IFunc,
     pub call_known: CallKnown,
     pub call_unknown: CallUnknown,
+    pub call_direct: CallDirect,
     pub boolean_const: BooleanConst,
     pub integer_const: IntegerConst,
     pub string_const: StringConst,
     pub list_const: ListConst,
     pub get_local: GetLocal,
     pub set_local: SetLocal,
+    pub tee_local: TeeLocal,
+    pub get_global: GetGlobal,
+    pub set_global: SetGlobal,
+    pub jump: Jump,
+    pub jump_if_false: JumpIfFalse,
+    pub loop_: Loop,
 }
 
 pub const IIMPORT: u8 = 0;
 pub const IFUNC: u8 = 1;
-pub const START_BLOCK: u8 = 2;
-pub const END_BLOCK: u8 = 3;
 pub const IRETURN: u8 = 4;
 pub const CALL_KNOWN: u8 = 5;
 pub const CALL_UNKNOWN: u8 = 6;
@@ -46,25 +110,49 @@ pub const LIST_CONST: u8 = 11;
 pub const GET_LOCAL: u8 = 12;
 pub const SET_LOCAL: u8 = 13;
 pub const DROP: u8 = 14;
-pub const IIF: u8 = 15;
 pub const LOOP: u8 = 16;
-pub const BREAK_IF: u8 = 17;
 pub const IGLOBAL: u8 = 18;
 pub const GET_FREE: u8 = 19;
 pub const SET_FREE: u8 = 20;
+pub const GET_GLOBAL: u8 = 21;
+pub const SET_GLOBAL: u8 = 22;
+pub const ADD: u8 = 23;
+pub const SUB: u8 = 24;
+pub const MUL: u8 = 25;
+pub const DIV: u8 = 26;
+pub const MOD: u8 = 27;
+pub const EQ: u8 = 28;
+pub const NE: u8 = 29;
+pub const LT: u8 = 30;
+pub const LE: u8 = 31;
+pub const GT: u8 = 32;
+pub const GE: u8 = 33;
+pub const AND: u8 = 34;
+pub const OR: u8 = 35;
+pub const NEGATE: u8 = 36;
+pub const NOT: u8 = 37;
+pub const INDEX: u8 = 38;
+pub const INDEX_SET: u8 = 39;
+pub const JUMP: u8 = 40;
+pub const JUMP_IF_FALSE: u8 = 41;
+pub const TEE_LOCAL: u8 = 42;
+pub const CALL_DIRECT: u8 = 43;
 
 #[repr(C)]
 #[derive(Clone, Copy)]
 pub struct IFunc {
     pub parm_count: u64,
-    pub ident: *const c_char,
+    pub ident: u32,
+    pub code_size: u64,
+    pub frame_size: u64,
+    pub max_stack: u64,
 }
 
 #[repr(C)]
 #[derive(Clone, Copy)]
 pub struct CallKnown {
     pub arg_count: u64,
-    pub ident: *const c_char,
+    pub ident: u32,
 }
 
 #[repr(C)]
@@ -73,6 +161,13 @@ pub struct CallUnknown {
     pub arg_count: u64,
 }
 
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct CallDirect {
+    pub arg_count: u64,
+    pub callee: u64,
+}
+
 #[repr(C)]
 #[derive(Clone, Copy)]
 pub struct BooleanConst {
@@ -88,7 +183,7 @@ pub struct IntegerConst {
 #[repr(C)]
 #[derive(Clone, Copy)]
 pub struct StringConst {
-    pub value: *const c_char,
+    pub value: u32,
 }
 
 #[repr(C)]
@@ -108,3 +203,39 @@ pub struct GetLocal {
 pub struct SetLocal {
     pub idx: u64,
 }
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct TeeLocal {
+    pub idx: u64,
+}
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct GetGlobal {
+    pub idx: u64,
+}
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct SetGlobal {
+    pub idx: u64,
+}
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct Jump {
+    pub offset: u64,
+}
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct JumpIfFalse {
+    pub offset: u64,
+}
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct Loop {
+    pub offset: u64,
+}
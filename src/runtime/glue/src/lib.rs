@@ -4,57 +4,133 @@ use std::{
     error::Error,
     ffi::{CStr, CString},
     os::raw::c_char,
+    ptr, slice,
 };
 
-use runtime::{instruction::Instruction, value::Block};
+use runtime::{
+    bytecode::Chunk,
+    image::Image,
+    instruction::{Instruction, Module},
+};
 
 use tracing::warn;
 
 extern "C" {
-    fn MercenaryGetInstructionFromString(source: *const c_char, len: u32) -> ctypes::Instructions;
+    fn MercenaryGetInstructionFromString(
+        source: *const c_char,
+        len: u32,
+        options: ctypes::CompileOptions,
+        passes: *mut ctypes::PassList,
+    ) -> ctypes::Instructions;
     fn MercenaryFreeInstructions(insns: ctypes::Instructions);
+    fn MercenaryGetImageFromString(
+        source: *const c_char,
+        len: u32,
+        options: ctypes::CompileOptions,
+        passes: *mut ctypes::PassList,
+    ) -> ctypes::Image;
+    fn MercenaryFreeImage(image: ctypes::Image);
+    fn MercenaryScanImports(source: *const c_char, len: u32) -> ctypes::ImportList;
+    fn MercenaryFreeImports(imports: ctypes::ImportList);
+    fn MercenaryFreePasses(passes: ctypes::PassList);
+}
+
+/// How the codegen should go about compiling a file
+#[derive(Clone, Copy, Debug)]
+pub struct Options {
+    /// How many threads the codegen may lower functions on
+    pub jobs: usize,
+    /// Like `codegen/main -O`: 0 doesn't optimize, 1 folds constants
+    pub opt_level: u32,
+}
+
+impl Options {
+    fn raw(self) -> ctypes::CompileOptions {
+        ctypes::CompileOptions {
+            jobs: self.jobs as u32,
+            opt_level: self.opt_level,
+        }
+    }
 }
 
-pub fn parse_instructions_from_buf(buf: &[u8]) -> Result<Vec<Instruction>, Box<dyn Error>> {
+/// How long one pass of the codegen took and how much it allocated, for `--time-passes` and
+/// `--mem-passes`
+#[derive(Clone, Debug)]
+pub struct PassStats {
+    pub name: String,
+    /// What `items` counts: tokens, bytes, nodes or instructions
+    pub unit: String,
+    pub items: u64,
+    pub seconds: f64,
+    pub cpu_seconds: f64,
+    /// Always zero from here. Counting them means replacing malloc for the whole process, which
+    /// only src/codegen/main and the bench do.
+    pub allocations: u64,
+    pub bytes_allocated: u64,
+}
+
+/// With `passes` every pass gets timed, and added to it
+pub fn parse_instructions_from_buf(
+    buf: &[u8],
+    options: Options,
+    passes: Option<&mut Vec<PassStats>>,
+) -> Result<Module, Box<dyn Error>> {
     let cstring = CString::new(buf)?;
 
+    let mut raw_passes = empty_pass_list();
     let raw_insns = unsafe {
-        MercenaryGetInstructionFromString(cstring.as_ptr(), libc::strlen(cstring.as_ptr()) as u32)
+        MercenaryGetInstructionFromString(
+            cstring.as_ptr(),
+            libc::strlen(cstring.as_ptr()) as u32,
+            options.raw(),
+            pass_list_for(&passes, &mut raw_passes),
+        )
     };
+    read_passes(raw_passes, passes);
 
-    let mut insns = vec![];
+    // Every distinct identifier/literal crosses the FFI once, instructions just index into it
+    let strings = read_strings(raw_insns.strings, raw_insns.string_count);
+
+    let mut insns = Vec::with_capacity(raw_insns.size as usize);
     for i in 0..raw_insns.size {
         let raw_insn = unsafe { *raw_insns.insns.add(i as usize) };
         match raw_insn.tag {
             ctypes::IIMPORT => insns.push(Instruction::Import),
             ctypes::IFUNC => {
                 let param_count = unsafe { raw_insn.insn.ifunc.parm_count };
-                let identifier = unsafe { CStr::from_ptr(raw_insn.insn.ifunc.ident) }
-                    .to_string_lossy()
-                    .into_owned();
+                let identifier = strings[unsafe { raw_insn.insn.ifunc.ident } as usize].clone();
+                let code_size = unsafe { raw_insn.insn.ifunc.code_size };
+                let frame_size = unsafe { raw_insn.insn.ifunc.frame_size };
+                let max_stack = unsafe { raw_insn.insn.ifunc.max_stack };
                 insns.push(Instruction::DefineFunction {
                     param_count,
                     identifier,
+                    code_size,
+                    frame_size,
+                    max_stack,
                 });
             }
-            ctypes::START_BLOCK => insns.push(Instruction::StartBlock),
-            ctypes::END_BLOCK => insns.push(Instruction::EndBlock),
             ctypes::IRETURN => insns.push(Instruction::Return),
             ctypes::CALL_KNOWN => {
                 let arg_count = unsafe { raw_insn.insn.call_known.arg_count };
-                let identifier = unsafe { CStr::from_ptr(raw_insn.insn.call_known.ident) }
-                    .to_string_lossy()
-                    .into_owned();
+                let identifier =
+                    strings[unsafe { raw_insn.insn.call_known.ident } as usize].clone();
                 tracing::trace!("glue: {}", identifier);
                 insns.push(Instruction::CallKnownFunction {
                     arg_count,
                     identifier,
+                    function: 0,
                 });
             }
             ctypes::CALL_UNKNOWN => {
                 let arg_count = unsafe { raw_insn.insn.call_unknown.arg_count };
                 insns.push(Instruction::CallUnknownFunction { arg_count });
             }
+            ctypes::CALL_DIRECT => {
+                let arg_count = unsafe { raw_insn.insn.call_direct.arg_count };
+                let slot = unsafe { raw_insn.insn.call_direct.callee };
+                insns.push(Instruction::CallDirectFunction { arg_count, slot });
+            }
             ctypes::NULL_CONST => insns.push(Instruction::NullConst),
             ctypes::BOOLEAN_CONST => {
                 let value = unsafe { raw_insn.insn.boolean_const.value };
@@ -65,9 +141,7 @@ pub fn parse_instructions_from_buf(buf: &[u8]) -> Result<Vec<Instruction>, Box<d
                 insns.push(Instruction::IntegerConst(value));
             }
             ctypes::STRING_CONST => {
-                let value = unsafe { CStr::from_ptr(raw_insn.insn.string_const.value) }
-                    .to_string_lossy()
-                    .into_owned();
+                let value = strings[unsafe { raw_insn.insn.string_const.value } as usize].clone();
                 insns.push(Instruction::StringConst(value));
             }
             ctypes::LIST_CONST => {
@@ -82,24 +156,174 @@ pub fn parse_instructions_from_buf(buf: &[u8]) -> Result<Vec<Instruction>, Box<d
                 let local_idx = unsafe { raw_insn.insn.set_local.idx };
                 insns.push(Instruction::SetLocal { local_idx });
             }
+            ctypes::TEE_LOCAL => {
+                let local_idx = unsafe { raw_insn.insn.tee_local.idx };
+                insns.push(Instruction::TeeLocal { local_idx });
+            }
             ctypes::DROP => insns.push(Instruction::Drop),
-            ctypes::IIF => insns.push(Instruction::If {
-                then: Block::default(),
-                else_: Block::default(),
-            }),
-            ctypes::LOOP => insns.push(Instruction::Loop {
-                block: Block::default(),
-            }),
-            // See doc comment on Instruction::BreakIfNot, too lazy to update the glue
-            ctypes::BREAK_IF => insns.push(Instruction::BreakIfNot),
+            ctypes::JUMP => {
+                let offset = unsafe { raw_insn.insn.jump.offset };
+                insns.push(Instruction::Jump { offset });
+            }
+            ctypes::JUMP_IF_FALSE => {
+                let offset = unsafe { raw_insn.insn.jump_if_false.offset };
+                insns.push(Instruction::JumpIfFalse { offset });
+            }
+            ctypes::LOOP => {
+                let offset = unsafe { raw_insn.insn.loop_.offset };
+                insns.push(Instruction::Loop { offset });
+            }
             ctypes::IGLOBAL => insns.push(Instruction::Global),
             ctypes::GET_FREE => insns.push(Instruction::GetFree),
             ctypes::SET_FREE => insns.push(Instruction::SetFree),
+            ctypes::GET_GLOBAL => {
+                let slot = unsafe { raw_insn.insn.get_global.idx };
+                insns.push(Instruction::GetGlobal { slot });
+            }
+            ctypes::SET_GLOBAL => {
+                let slot = unsafe { raw_insn.insn.set_global.idx };
+                insns.push(Instruction::SetGlobal { slot });
+            }
+            ctypes::ADD => insns.push(Instruction::Add),
+            ctypes::SUB => insns.push(Instruction::Sub),
+            ctypes::MUL => insns.push(Instruction::Mul),
+            ctypes::DIV => insns.push(Instruction::Div),
+            ctypes::MOD => insns.push(Instruction::Mod),
+            ctypes::EQ => insns.push(Instruction::Eq),
+            ctypes::NE => insns.push(Instruction::Ne),
+            ctypes::LT => insns.push(Instruction::Lt),
+            ctypes::LE => insns.push(Instruction::Le),
+            ctypes::GT => insns.push(Instruction::Gt),
+            ctypes::GE => insns.push(Instruction::Ge),
+            ctypes::AND => insns.push(Instruction::And),
+            ctypes::OR => insns.push(Instruction::Or),
+            ctypes::NEGATE => insns.push(Instruction::Negate),
+            ctypes::NOT => insns.push(Instruction::Not),
+            ctypes::INDEX => insns.push(Instruction::Index),
+            ctypes::INDEX_SET => insns.push(Instruction::IndexSet),
             unk => warn!("Found unknow raw insn tag: {}", unk),
         }
     }
 
+    let globals = read_globals(raw_insns.globals, raw_insns.global_count, &strings);
+
     unsafe { MercenaryFreeInstructions(raw_insns) };
 
-    Ok(insns)
+    Ok(Module {
+        instructions: insns,
+        globals,
+    })
+}
+
+/// Like `parse_instructions_from_buf`, but for the threaded engine. The codegen writes the same
+/// image `codegen/main -o` would, which only gets copied once to keep it aligned.
+pub fn parse_bytecode_from_buf(
+    buf: &[u8],
+    options: Options,
+    passes: Option<&mut Vec<PassStats>>,
+) -> Result<Chunk, Box<dyn Error>> {
+    let cstring = CString::new(buf)?;
+
+    let mut raw_passes = empty_pass_list();
+    let raw_image = unsafe {
+        MercenaryGetImageFromString(
+            cstring.as_ptr(),
+            libc::strlen(cstring.as_ptr()) as u32,
+            options.raw(),
+            pass_list_for(&passes, &mut raw_passes),
+        )
+    };
+    read_passes(raw_passes, passes);
+
+    let image = Image::from_bytes(unsafe { raw_slice(raw_image.data, raw_image.size as usize) });
+
+    unsafe { MercenaryFreeImage(raw_image) };
+
+    Chunk::from_image(image)
+}
+
+/// The paths of every `import` in a source file, found without parsing it
+pub fn scan_imports(buf: &[u8]) -> Result<Vec<String>, Box<dyn Error>> {
+    let cstring = CString::new(buf)?;
+
+    let raw_imports =
+        unsafe { MercenaryScanImports(cstring.as_ptr(), libc::strlen(cstring.as_ptr()) as u32) };
+
+    let imports = read_strings(raw_imports.paths, raw_imports.count);
+
+    unsafe { MercenaryFreeImports(raw_imports) };
+
+    Ok(imports)
+}
+
+fn empty_pass_list() -> ctypes::PassList {
+    ctypes::PassList {
+        passes: ptr::null(),
+        count: 0,
+        owner: ptr::null_mut(),
+    }
+}
+
+/// Null tells the codegen not to bother timing anything
+fn pass_list_for(
+    passes: &Option<&mut Vec<PassStats>>,
+    raw: &mut ctypes::PassList,
+) -> *mut ctypes::PassList {
+    match passes {
+        Some(_) => raw,
+        None => ptr::null_mut(),
+    }
+}
+
+fn read_passes(raw: ctypes::PassList, passes: Option<&mut Vec<PassStats>>) {
+    let passes = match passes {
+        Some(passes) => passes,
+        None => return,
+    };
+
+    let string = |raw: *const c_char| {
+        unsafe { CStr::from_ptr(raw) }
+            .to_string_lossy()
+            .into_owned()
+    };
+
+    for raw in unsafe { raw_slice(raw.passes, raw.count as usize) } {
+        passes.push(PassStats {
+            name: string(raw.name),
+            unit: string(raw.unit),
+            items: raw.items,
+            seconds: raw.seconds,
+            cpu_seconds: raw.cpu_seconds,
+            allocations: raw.allocations,
+            bytes_allocated: raw.bytes_allocated,
+        });
+    }
+
+    unsafe { MercenaryFreePasses(raw) };
+}
+
+/// Empty vectors on the C++ side can hand out null, which `slice::from_raw_parts` doesn't like
+unsafe fn raw_slice<'a, T>(data: *const T, len: usize) -> &'a [T] {
+    if len == 0 {
+        &[]
+    } else {
+        slice::from_raw_parts(data, len)
+    }
+}
+
+fn read_strings(raw: *const ctypes::StringRef, count: u32) -> Vec<String> {
+    unsafe { raw_slice(raw, count as usize) }
+        .iter()
+        .map(|raw| {
+            let bytes = unsafe { raw_slice(raw.data as *const u8, raw.len as usize) };
+            String::from_utf8_lossy(bytes).into_owned()
+        })
+        .collect()
+}
+
+fn read_globals(raw: *const u32, count: u32, strings: &[String]) -> Vec<String> {
+    unsafe { raw_slice(raw, count as usize) }
+        .iter()
+        .map(|&id| strings[id as usize].clone())
+        .collect()
 }
@@ -0,0 +1,72 @@
+//! Runs the knight interpreter in examples/knight on a few knight programs with each engine, and
+//! prints how long they took. `cargo bench -p merc`, or `MERC_BENCH_RUNS=20 cargo bench -p merc`
+//! for less noise.
+
+use std::{
+    env,
+    process::{Command, Stdio},
+    time::{Duration, Instant},
+};
+
+const KNIGHT: &str = concat!(env!("CARGO_MANIFEST_DIR"), "/../../../examples/knight/main.merc");
+
+const ENGINES: &[&str] = &["instructions", "threaded"];
+
+const WORKLOADS: &[(&str, &str)] = &[
+    (
+        "loop",
+        "; = n 3000 ; = a 0 ; = b 1 ; WHILE n ; = t b ; = b + a b ; = a t : = n - n 1 : OUTPUT a",
+    ),
+    (
+        "strings",
+        "; = s \"\" ; = i 0 ; WHILE < i 1000 ; = s + s i : = i + i 1 : OUTPUT LENGTH s",
+    ),
+    (
+        "recursion",
+        "; = f BLOCK IF < n 2 1 ; = n - n 1 + 1 CALL f ; = n 300 : OUTPUT CALL f",
+    ),
+];
+
+fn run_once(engine: &str, program: &str) -> Duration {
+    let start = Instant::now();
+    let status = Command::new(env!("CARGO_BIN_EXE_merc"))
+        .args(["--engine", engine, KNIGHT, program])
+        .stdout(Stdio::null())
+        .status()
+        .expect("couldn't start merc");
+    let elapsed = start.elapsed();
+
+    assert!(status.success(), "{} failed on {:?}", engine, program);
+
+    elapsed
+}
+
+fn median(mut times: Vec<Duration>) -> Duration {
+    times.sort();
+    times[times.len() / 2]
+}
+
+fn main() {
+    let runs = env::var("MERC_BENCH_RUNS")
+        .ok()
+        .and_then(|runs| runs.parse().ok())
+        .unwrap_or(5usize)
+        .max(1);
+
+    println!("{:<12}{:>16}{:>16}{:>10}", "workload", ENGINES[0], ENGINES[1], "speedup");
+
+    for (name, program) in WORKLOADS {
+        let medians = ENGINES
+            .iter()
+            .map(|engine| median((0..runs).map(|_| run_once(engine, program)).collect()))
+            .collect::<Vec<_>>();
+
+        println!(
+            "{:<12}{:>14.2}ms{:>14.2}ms{:>9.2}x",
+            name,
+            medians[0].as_secs_f64() * 1000.0,
+            medians[1].as_secs_f64() * 1000.0,
+            medians[0].as_secs_f64() / medians[1].as_secs_f64(),
+        );
+    }
+}
@@ -0,0 +1,224 @@
+//! Keeps track of which files have been loaded, by a hash of their canonical path and contents, so
+//! a module imported from several files is only compiled and run once. With a cache directory the
+//! compiled images also outlive the process, and unchanged files never get compiled again.
+
+use std::{
+    collections::{HashMap, HashSet},
+    error::Error,
+    fs::{self, File},
+    io::{Read, Seek, SeekFrom},
+    path::{Path, PathBuf},
+    process,
+};
+
+use runtime::{
+    bytecode::Chunk,
+    image::{self, Image},
+    runtime::Program,
+};
+use tracing::warn;
+
+use crate::{compile, graph, Engine, Report};
+
+pub struct Cache {
+    engine: Engine,
+    dir: Option<PathBuf>,
+    report: Report,
+    opt_level: u32,
+    loaded: HashSet<u64>,
+    /// Compiled ahead of time by `precompile`, waiting for something to import them
+    compiled: HashMap<PathBuf, Result<(u64, Program), String>>,
+}
+
+impl Cache {
+    pub fn new(engine: Engine, dir: Option<PathBuf>, report: Report, opt_level: u32) -> Cache {
+        Cache {
+            engine,
+            dir,
+            report,
+            opt_level,
+            loaded: HashSet::new(),
+            compiled: HashMap::new(),
+        }
+    }
+
+    /// Compiles `root` and everything it imports on `jobs` threads, before any of it runs
+    pub fn precompile(&mut self, root: &Path, base_path: &Path, jobs: usize) {
+        self.compiled = graph::compile_all(
+            root,
+            base_path,
+            self.engine,
+            self.dir.as_deref(),
+            self.report,
+            glue::Options {
+                jobs,
+                opt_level: self.opt_level,
+            },
+        );
+    }
+
+    /// Compiles a source file, or maps a bytecode image written by `codegen/main -o` and runs it in
+    /// place. `None` if this exact file has been loaded before.
+    pub fn load(&mut self, path: &Path) -> Result<Option<Program>, Box<dyn Error>> {
+        let path = path.canonicalize()?;
+
+        let (key, program) = match self.compiled.remove(&path) {
+            Some(compiled) => compiled?,
+            None => {
+                let source = Source::read(&path, self.engine, self.opt_level)?;
+                if self.loaded.contains(&source.key) {
+                    return Ok(None);
+                }
+
+                (
+                    source.key,
+                    source.compile(
+                        self.engine,
+                        self.dir.as_deref(),
+                        self.report,
+                        glue::Options {
+                            jobs: 1,
+                            opt_level: self.opt_level,
+                        },
+                    )?,
+                )
+            }
+        };
+
+        if !self.loaded.insert(key) {
+            return Ok(None);
+        }
+
+        Ok(Some(program))
+    }
+}
+
+/// A file that's been read and hashed, but not compiled yet. Unlike `Cache` it doesn't mind which
+/// thread it's on.
+pub struct Source {
+    pub path: PathBuf,
+    pub key: u64,
+    contents: Contents,
+}
+
+enum Contents {
+    Text(Vec<u8>),
+    Image(Image),
+}
+
+impl Source {
+    /// `path` has to be canonical already. It's part of the key, and so is `opt_level`.
+    pub fn read(path: &Path, engine: Engine, opt_level: u32) -> Result<Source, Box<dyn Error>> {
+        let mut file = File::open(path)?;
+
+        let mut magic = [0; image::MAGIC.len()];
+        let contents = if file.read_exact(&mut magic).is_ok() && image::is_image(&magic) {
+            match engine {
+                Engine::Threaded => Contents::Image(Image::map(&file)?),
+                Engine::Instructions => {
+                    return Err("bytecode images only run on the threaded engine".into())
+                }
+            }
+        } else {
+            file.seek(SeekFrom::Start(0))?;
+            let mut buf = vec![];
+            file.read_to_end(&mut buf)?;
+            Contents::Text(buf)
+        };
+
+        let key = match &contents {
+            Contents::Text(buf) => key(path, buf, opt_level),
+            Contents::Image(image) => key(path, image.bytes(), opt_level),
+        };
+
+        Ok(Source {
+            path: path.to_path_buf(),
+            key,
+            contents,
+        })
+    }
+
+    /// What this file imports, as written. Images are already compiled, so their imports get
+    /// found when they run instead.
+    pub fn imports(&self) -> Result<Vec<String>, Box<dyn Error>> {
+        match &self.contents {
+            Contents::Text(buf) => glue::scan_imports(buf),
+            Contents::Image(_) => Ok(vec![]),
+        }
+    }
+
+    /// Files that don't need compiling don't show up in the report
+    pub fn compile(
+        self,
+        engine: Engine,
+        dir: Option<&Path>,
+        report: Report,
+        options: glue::Options,
+    ) -> Result<Program, Box<dyn Error>> {
+        let buf = match self.contents {
+            Contents::Text(buf) => buf,
+            Contents::Image(image) => return Ok(Program::Bytecode(Chunk::from_image(image)?)),
+        };
+
+        // Only the threaded engine's code has a form that can be written out
+        let cached = match (engine, dir) {
+            (Engine::Threaded, Some(dir)) => dir.join(format!("{:016x}.mercb", self.key)),
+            _ => return compile(&self.path, &buf, engine, options, report),
+        };
+
+        // Anything wrong with the cached copy, like being from an older version, just means
+        // compiling it again
+        if let Ok(chunk) = File::open(&cached)
+            .map_err(Box::<dyn Error>::from)
+            .and_then(|file| Chunk::from_image(Image::map(&file)?))
+        {
+            return Ok(Program::Bytecode(chunk));
+        }
+
+        let program = compile(&self.path, &buf, engine, options, report)?;
+        if let Program::Bytecode(chunk) = &program {
+            if let Err(why) = store(&cached, chunk.bytes()) {
+                warn!(
+                    "Failed to cache {:?} as {:?}, error={}",
+                    self.path, cached, why
+                );
+            }
+        }
+
+        Ok(program)
+    }
+}
+
+/// Writes next to the destination first, so nothing ever maps a half written image
+fn store(cached: &Path, bytes: &[u8]) -> std::io::Result<()> {
+    if let Some(dir) = cached.parent() {
+        fs::create_dir_all(dir)?;
+    }
+
+    let partial = cached.with_extension(format!("{}.partial", process::id()));
+    fs::write(&partial, bytes)?;
+    fs::rename(&partial, cached)
+}
+
+/// FNV-1a, which unlike `DefaultHasher` is guaranteed to hash the same in every build. The merc
+/// and image versions are mixed in so upgrading never picks up another compiler's output.
+fn key(path: &Path, contents: &[u8], opt_level: u32) -> u64 {
+    let version = format!(
+        "{}/{}/O{}",
+        env!("CARGO_PKG_VERSION"),
+        image::VERSION,
+        opt_level
+    );
+    let path = path.to_string_lossy();
+
+    let mut hash = 0xcbf29ce484222325u64;
+    for part in [version.as_bytes(), path.as_bytes(), contents] {
+        // Separated by their length, so moving bytes from one part to the next changes the key
+        for &byte in (part.len() as u64).to_le_bytes().iter().chain(part) {
+            hash ^= byte as u64;
+            hash = hash.wrapping_mul(0x100000001b3);
+        }
+    }
+
+    hash
+}
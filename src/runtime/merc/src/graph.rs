@@ -0,0 +1,170 @@
+//! Compiles a program's whole import graph before any of it runs. Each file's imports are found by
+//! only running the lexer over it, which is cheap next to compiling it, so they're handed to the
+//! workers long before the file that imports them is done. That makes the whole graph take about
+//! as long as its slowest file instead of all of them added up.
+
+use std::{
+    any::Any,
+    collections::{HashMap, HashSet},
+    error::Error,
+    panic::{self, AssertUnwindSafe},
+    path::{Path, PathBuf},
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        mpsc, Mutex,
+    },
+    thread,
+};
+
+use runtime::runtime::Program;
+
+use crate::{cache::Source, Engine, Report};
+
+enum Message {
+    /// Files that something imports, sent before the importer starts compiling
+    Imports(Vec<PathBuf>),
+    Compiled(PathBuf, Result<(u64, Program), String>),
+}
+
+/// Everything reachable from `root`, by canonical path. Imports resolve against `base_path` like
+/// the runtime resolves them. Errors are kept instead of reported, so they only come up if the
+/// file actually gets imported, same as without compiling ahead of time.
+pub fn compile_all(
+    root: &Path,
+    base_path: &Path,
+    engine: Engine,
+    dir: Option<&Path>,
+    report: Report,
+    options: glue::Options,
+) -> HashMap<PathBuf, Result<(u64, Program), String>> {
+    let mut compiled = HashMap::new();
+
+    let root = match root.canonicalize() {
+        Ok(root) => root,
+        Err(_) => return compiled,
+    };
+
+    let (job_sender, jobs_receiver) = mpsc::channel::<PathBuf>();
+    let jobs_receiver = Mutex::new(jobs_receiver);
+    let (message_sender, messages) = mpsc::channel();
+
+    // Whoever isn't busy with a file of their own lends their thread to lowering functions
+    let busy = AtomicUsize::new(0);
+
+    thread::scope(|scope| {
+        for _ in 0..options.jobs.max(1) {
+            let jobs_receiver = &jobs_receiver;
+            let busy = &busy;
+            let message_sender = message_sender.clone();
+
+            scope.spawn(move || loop {
+                let path = match jobs_receiver.lock().unwrap().recv() {
+                    Ok(path) => path,
+                    Err(_) => return,
+                };
+
+                // A job that panics still has to be answered for, or the loop below would wait on
+                // it forever while the other workers keep the channel open
+                let result = panic::catch_unwind(AssertUnwindSafe(|| {
+                    compile_one(
+                        &path,
+                        base_path,
+                        engine,
+                        dir,
+                        report,
+                        options,
+                        busy,
+                        &message_sender,
+                    )
+                }))
+                .unwrap_or_else(|panic| Err(panic_message(&*panic)));
+
+                message_sender
+                    .send(Message::Compiled(path, result))
+                    .unwrap();
+            });
+        }
+
+        // Only the workers' copies are left. Every job gets a Compiled back even if it panics,
+        // so the loop below always finishes.
+        drop(message_sender);
+
+        let mut seen = HashSet::new();
+        seen.insert(root.clone());
+        job_sender.send(root).unwrap();
+        let mut pending = 1;
+
+        while pending > 0 {
+            match messages.recv().unwrap() {
+                Message::Imports(imports) => {
+                    for import in imports {
+                        if seen.insert(import.clone()) {
+                            job_sender.send(import).unwrap();
+                            pending += 1;
+                        }
+                    }
+                }
+                Message::Compiled(path, result) => {
+                    compiled.insert(path, result);
+                    pending -= 1;
+                }
+            }
+        }
+
+        // Hangs up on the workers, which is what tells them to stop
+        drop(job_sender);
+    });
+
+    compiled
+}
+
+/// Reads one file, tells the main loop what it imports, then compiles it
+fn compile_one(
+    path: &Path,
+    base_path: &Path,
+    engine: Engine,
+    dir: Option<&Path>,
+    report: Report,
+    options: glue::Options,
+    busy: &AtomicUsize,
+    message_sender: &mpsc::Sender<Message>,
+) -> Result<(u64, Program), String> {
+    let result = Source::read(path, engine, options.opt_level).and_then(|source| {
+        let imports = source
+            .imports()?
+            .iter()
+            .filter_map(|import| base_path.join(import).canonicalize().ok())
+            .collect();
+        message_sender.send(Message::Imports(imports)).unwrap();
+
+        let key = source.key;
+        let idle = options
+            .jobs
+            .saturating_sub(busy.fetch_add(1, Ordering::Relaxed));
+        let compiled = source.compile(
+            engine,
+            dir,
+            report,
+            glue::Options {
+                jobs: idle.max(1),
+                ..options
+            },
+        );
+        busy.fetch_sub(1, Ordering::Relaxed);
+
+        Ok::<_, Box<dyn Error>>((key, compiled?))
+    });
+
+    result.map_err(|why| why.to_string())
+}
+
+/// What `panic!` was given, which is almost always a string of some kind
+fn panic_message(panic: &(dyn Any + Send)) -> String {
+    if let Some(message) = panic.downcast_ref::<&str>() {
+        format!("compiling panicked: {}", message)
+    } else if let Some(message) = panic.downcast_ref::<String>() {
+        format!("compiling panicked: {}", message)
+    } else {
+        "compiling panicked".into()
+    }
+}
@@ -1,9 +1,112 @@
-use std::{cell::RefCell, fs::File, io::Read, path::Path, process::exit, rc::Rc};
+mod cache;
+mod graph;
 
+use std::{
+    cell::RefCell,
+    error::Error,
+    io::{self, Write},
+    path::Path,
+    process::exit,
+    rc::Rc,
+    thread,
+};
+
+use cache::Cache;
 use clap::{crate_authors, crate_version, App, Arg};
-use runtime::value::Value;
+use runtime::{runtime::Program, value::Value};
 use tracing::error;
 
+#[derive(Clone, Copy)]
+pub enum Engine {
+    Threaded,
+    Instructions,
+}
+
+/// Which of `--time-passes` and `--mem-passes` were given
+#[derive(Clone, Copy)]
+pub struct Report {
+    pub time: bool,
+    pub memory: bool,
+}
+
+impl Report {
+    fn any(self) -> bool {
+        self.time || self.memory
+    }
+
+    /// The same table `codegen/main` prints, all at once so files compiled on different threads
+    /// don't end up mixed together
+    fn print(self, path: &Path, passes: &[glue::PassStats]) {
+        let mut out = format!("{}\n{:<16}", path.display(), "pass");
+        if self.time {
+            out += &format!(" {:>12} {:>12}", "wall ms", "cpu ms");
+        }
+        if self.memory {
+            out += &format!(" {:>12} {:>14}", "allocations", "bytes");
+        }
+        out += &format!(" {:>12}\n", "items");
+
+        let total = glue::PassStats {
+            name: "total".into(),
+            unit: String::new(),
+            items: 0,
+            seconds: passes.iter().map(|pass| pass.seconds).sum(),
+            cpu_seconds: passes.iter().map(|pass| pass.cpu_seconds).sum(),
+            allocations: passes.iter().map(|pass| pass.allocations).sum(),
+            bytes_allocated: passes.iter().map(|pass| pass.bytes_allocated).sum(),
+        };
+
+        for pass in passes.iter().chain(Some(&total)) {
+            out += &format!("{:<16}", pass.name);
+            if self.time {
+                out += &format!(
+                    " {:>12.3} {:>12.3}",
+                    pass.seconds * 1e3,
+                    pass.cpu_seconds * 1e3
+                );
+            }
+            if self.memory {
+                out += &format!(" {:>12} {:>14}", pass.allocations, pass.bytes_allocated);
+            }
+            if !pass.unit.is_empty() {
+                out += &format!(" {:>12} {}", pass.items, pass.unit);
+            }
+            out += "\n";
+        }
+
+        let _ = io::stderr().lock().write_all(out.as_bytes());
+    }
+}
+
+/// `path` is only for the report
+fn compile(
+    path: &Path,
+    buf: &[u8],
+    engine: Engine,
+    options: glue::Options,
+    report: Report,
+) -> Result<Program, Box<dyn Error>> {
+    let mut passes = vec![];
+    let wanted = if report.any() {
+        Some(&mut passes)
+    } else {
+        None
+    };
+
+    let program = match engine {
+        Engine::Threaded => Program::Bytecode(glue::parse_bytecode_from_buf(buf, options, wanted)?),
+        Engine::Instructions => {
+            Program::Instructions(glue::parse_instructions_from_buf(buf, options, wanted)?)
+        }
+    };
+
+    if report.any() {
+        report.print(path, &passes);
+    }
+
+    Ok(program)
+}
+
 fn main() {
     tracing_subscriber::fmt().init();
 
@@ -12,7 +115,7 @@ fn main() {
         .author(crate_authors!())
         .arg(
             Arg::with_name("INPUT")
-                .help("The mercenary file to execute")
+                .help("The mercenary file or bytecode image to execute")
                 .required(true),
         )
         .arg(
@@ -23,12 +126,55 @@ fn main() {
                 .value_delimiter(" ")
                 .multiple(true),
         )
+        .arg(
+            Arg::with_name("engine")
+                .long("engine")
+                .help("Which interpreter runs the program, `threaded` or the older `instructions`")
+                .takes_value(true)
+                .possible_values(&["threaded", "instructions"])
+                .default_value("threaded"),
+        )
+        .arg(
+            Arg::with_name("cache-dir")
+                .long("cache-dir")
+                .help("Where to keep compiled images of every file, so unchanged ones aren't compiled again")
+                .takes_value(true),
+        )
+        .arg(
+            Arg::with_name("jobs")
+                .long("jobs")
+                .short("j")
+                .help("How many threads compile the program and its imports, defaults to one per core")
+                .takes_value(true),
+        )
+        .arg(
+            Arg::with_name("opt-level")
+                .long("opt-level")
+                .short("O")
+                .help("How hard to optimize, 0 doesn't and 1 folds constants")
+                .takes_value(true)
+                .possible_values(&["0", "1"])
+                .default_value("1"),
+        )
+        .arg(
+            Arg::with_name("max-depth")
+                .long("max-depth")
+                .help("How many calls can be in progress at once before the program is stopped")
+                .takes_value(true),
+        )
+        .arg(
+            Arg::with_name("time-passes")
+                .long("time-passes")
+                .help("Print how long each pass of compiling every file took"),
+        )
+        .arg(
+            Arg::with_name("mem-passes")
+                .long("mem-passes")
+                .help("Print how much each pass of compiling every file allocated"),
+        )
         .get_matches();
 
     let file_path = matches.value_of("INPUT").unwrap();
-    let mut file = File::open(file_path).unwrap();
-    let mut buf = vec![];
-    file.read_to_end(&mut buf).unwrap();
 
     let argv = match matches.values_of("argv").map(|s| s.collect::<Vec<_>>()) {
         Some(argv) => {
@@ -42,7 +188,10 @@ fn main() {
         None => Value::Null,
     };
 
-    let insns = glue::parse_instructions_from_buf(&buf).unwrap();
+    let engine = match matches.value_of("engine") {
+        Some("instructions") => Engine::Instructions,
+        _ => Engine::Threaded,
+    };
 
     let base_path = match Path::new(file_path).canonicalize() {
         Ok(base_path) => base_path,
@@ -60,24 +209,48 @@ fn main() {
     }
     .to_path_buf();
 
+    let jobs = matches
+        .value_of("jobs")
+        .and_then(|jobs| jobs.parse().ok())
+        .or_else(|| thread::available_parallelism().ok().map(Into::into))
+        .unwrap_or(1);
+
+    let opt_level = matches
+        .value_of("opt-level")
+        .and_then(|level| level.parse().ok())
+        .unwrap_or(1);
+
+    let report = Report {
+        time: matches.is_present("time-passes"),
+        memory: matches.is_present("mem-passes"),
+    };
+
+    let mut cache = Cache::new(
+        engine,
+        matches.value_of("cache-dir").map(Into::into),
+        report,
+        opt_level,
+    );
+    cache.precompile(Path::new(file_path), &base_path, jobs);
+    let program = cache.load(Path::new(file_path)).unwrap().unwrap();
+
     let mut merc_runtime = runtime::runtime::Runtime::create(
-        Box::new(|path, base_path| {
-            let path = base_path.join(path).canonicalize().unwrap();
-            let mut file = File::open(path).unwrap();
-            let mut buf = vec![];
-            file.read_to_end(&mut buf).unwrap();
-
-            glue::parse_instructions_from_buf(&buf)
-        }),
+        Box::new(move |path, base_path| cache.load(&base_path.join(path))),
         runtime::intrinsics::INTRINSICS,
         argv,
         base_path,
     );
 
-    merc_runtime.execute_program(&insns);
+    if let Some(max_depth) = matches
+        .value_of("max-depth")
+        .and_then(|depth| depth.parse().ok())
+    {
+        merc_runtime.set_max_depth(max_depth);
+    }
+
+    merc_runtime.execute_program(program);
 
-    let return_value = merc_runtime.pop_value_from_stack();
+    let return_value = merc_runtime.exit_value();
     drop(merc_runtime);
-    drop(file);
     std::process::exit(return_value.to_integer() as i32)
 }
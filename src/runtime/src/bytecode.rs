@@ -0,0 +1,172 @@
+//! The compact form of a compiled file, run by the threaded engine. Mirrors `codegen::Op` and
+//! friends in src/codegen/bytecode.hpp, so images can be run without translating them.
+
+use std::{error::Error, fmt::Debug, str};
+
+use crate::{
+    image::{Header, Image, StringSpan},
+    verify::verify_chunk,
+};
+
+pub mod opcode {
+    pub const IMPORT: u8 = 0;
+    pub const DEFINE_FUNCTION: u8 = 1;
+    pub const RETURN: u8 = 2;
+    pub const CALL_KNOWN: u8 = 3;
+    pub const CALL_UNKNOWN: u8 = 4;
+    pub const NULL_CONST: u8 = 5;
+    pub const BOOLEAN_CONST: u8 = 6;
+    pub const INTEGER_CONST: u8 = 7;
+    pub const STRING_CONST: u8 = 8;
+    pub const LIST_CONST: u8 = 9;
+    pub const GET_LOCAL: u8 = 10;
+    pub const SET_LOCAL: u8 = 11;
+    pub const DROP: u8 = 12;
+    pub const JUMP: u8 = 13;
+    pub const JUMP_IF_FALSE: u8 = 14;
+    pub const LOOP: u8 = 15;
+    pub const GLOBAL: u8 = 16;
+    pub const GET_FREE: u8 = 17;
+    pub const SET_FREE: u8 = 18;
+    pub const GET_GLOBAL: u8 = 19;
+    pub const SET_GLOBAL: u8 = 20;
+    pub const ADD: u8 = 21;
+    pub const SUB: u8 = 22;
+    pub const MUL: u8 = 23;
+    pub const DIV: u8 = 24;
+    pub const MOD: u8 = 25;
+    pub const EQ: u8 = 26;
+    pub const NE: u8 = 27;
+    pub const LT: u8 = 28;
+    pub const LE: u8 = 29;
+    pub const GT: u8 = 30;
+    pub const GE: u8 = 31;
+    pub const AND: u8 = 32;
+    pub const OR: u8 = 33;
+    pub const NEGATE: u8 = 34;
+    pub const NOT: u8 = 35;
+    pub const INDEX: u8 = 36;
+    pub const INDEX_SET: u8 = 37;
+    pub const TEE_LOCAL: u8 = 38;
+    pub const CALL_DIRECT: u8 = 39;
+}
+
+/// One instruction. What `operand` and `count` mean depends on the opcode, see bytecode.hpp
+#[repr(C)]
+#[derive(Clone, Copy, Debug)]
+pub struct Op {
+    pub opcode: u8,
+    pub unused: u8,
+    pub count: u16,
+    pub operand: u32,
+}
+
+#[repr(C)]
+#[derive(Clone, Copy, Debug)]
+pub struct FunctionEntry {
+    pub ident: u32,
+    pub parm_count: u32,
+    pub start: u32,
+    pub size: u32,
+    pub frame_size: u32,
+    pub max_stack: u32,
+}
+
+/// One file's worth of bytecode. Everything but `global_slots` lives in the image it was loaded
+/// from, which is only ever read.
+pub struct Chunk {
+    image: Image,
+    header: Header,
+    /// The runtime's slot for each of this file's globals, filled in when the chunk gets linked
+    pub global_slots: Vec<u64>,
+    /// The runtime's function id for each string a CallKnown names, filled in along with
+    /// `global_slots`. Other strings are left at `u32::MAX`.
+    pub known_functions: Vec<u32>,
+}
+
+impl Chunk {
+    pub fn from_image(image: Image) -> Result<Chunk, Box<dyn Error>> {
+        let header = image.header()?;
+        let chunk = Chunk {
+            image,
+            header,
+            global_slots: Vec::new(),
+            known_functions: Vec::new(),
+        };
+
+        // `string` hands these out without checking them again
+        let bytes = chunk.string_bytes();
+        for span in chunk.spans() {
+            let string = bytes
+                .get(span.offset as usize..span.offset as usize + span.len as usize)
+                .ok_or("bytecode image has a string out of bounds")?;
+            str::from_utf8(string)?;
+        }
+
+        let string_count = chunk.spans().len();
+        if chunk
+            .globals()
+            .iter()
+            .any(|&id| id as usize >= string_count)
+            || chunk
+                .functions()
+                .iter()
+                .any(|entry| entry.ident as usize >= string_count)
+        {
+            return Err("bytecode image refers to a string it doesn't have".into());
+        }
+
+        verify_chunk(&chunk)?;
+
+        Ok(chunk)
+    }
+
+    /// The whole image, exactly as it would be written to disk
+    pub fn bytes(&self) -> &[u8] {
+        self.image.bytes()
+    }
+
+    pub fn code(&self) -> &[Op] {
+        unsafe { self.image.section(self.header.code) }
+    }
+
+    pub fn integers(&self) -> &[i64] {
+        unsafe { self.image.section(self.header.integers) }
+    }
+
+    pub fn functions(&self) -> &[FunctionEntry] {
+        unsafe { self.image.section(self.header.functions) }
+    }
+
+    /// This file's global slots, as the StringId of their name
+    pub fn globals(&self) -> &[u32] {
+        unsafe { self.image.section(self.header.globals) }
+    }
+
+    pub fn string(&self, id: u32) -> &str {
+        let span = self.spans()[id as usize];
+        let bytes = &self.string_bytes()[span.offset as usize..(span.offset + span.len) as usize];
+        unsafe { str::from_utf8_unchecked(bytes) }
+    }
+
+    pub fn string_count(&self) -> usize {
+        self.spans().len()
+    }
+
+    fn spans(&self) -> &[StringSpan] {
+        unsafe { self.image.section(self.header.strings) }
+    }
+
+    fn string_bytes(&self) -> &[u8] {
+        unsafe { self.image.section(self.header.string_bytes) }
+    }
+}
+
+impl Debug for Chunk {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("Chunk")
+            .field("code_size", &self.code().len())
+            .field("functions", &self.functions().len())
+            .finish()
+    }
+}
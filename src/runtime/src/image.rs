@@ -0,0 +1,215 @@
+//! Bytecode images, the on-disk form of a `Chunk` written by `codegen/main -o`. See the Images
+//! section of src/codegen/bytecode.hpp for the layout, `Header` below mirrors it. An image is run
+//! straight out of its bytes: a file gets mapped read-only, and the chunk's code, tables and
+//! strings all point into the mapping.
+
+use std::{error::Error, fs::File, io, mem, slice};
+
+pub const MAGIC: [u8; 8] = *b"MERCBYTE";
+pub const VERSION: u32 = 7;
+const BYTE_ORDER: u32 = 0x01020304;
+
+/// `count` elements starting `offset` bytes into the image
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct Section {
+    pub offset: u64,
+    pub count: u64,
+}
+
+/// Where one string lives in the `string_bytes` section
+#[repr(C)]
+#[derive(Clone, Copy, Debug)]
+pub struct StringSpan {
+    pub offset: u32,
+    pub len: u32,
+}
+
+#[repr(C)]
+#[derive(Clone, Copy, Debug)]
+pub struct Header {
+    pub magic: [u8; 8],
+    pub version: u32,
+    pub byte_order: u32,
+    pub code: Section,
+    pub integers: Section,
+    pub functions: Section,
+    pub globals: Section,
+    pub strings: Section,
+    pub string_bytes: Section,
+}
+
+pub fn is_image(bytes: &[u8]) -> bool {
+    bytes.starts_with(&MAGIC)
+}
+
+/// The bytes of an image, kept 8 byte aligned so sections can be read in place
+pub enum Image {
+    Owned(Vec<u64>, usize),
+    #[cfg(unix)]
+    Mapped(Mapping),
+}
+
+impl Image {
+    /// Copies an image that's already in memory, like the one the glue hands over
+    pub fn from_bytes(bytes: &[u8]) -> Image {
+        let mut words = vec![0u64; (bytes.len() + 7) / 8];
+        unsafe {
+            std::ptr::copy_nonoverlapping(
+                bytes.as_ptr(),
+                words.as_mut_ptr() as *mut u8,
+                bytes.len(),
+            );
+        }
+        Image::Owned(words, bytes.len())
+    }
+
+    /// Maps the whole file, or reads it where there's no `mmap`
+    pub fn map(file: &File) -> io::Result<Image> {
+        #[cfg(unix)]
+        {
+            Mapping::new(file).map(Image::Mapped)
+        }
+
+        #[cfg(not(unix))]
+        {
+            use std::io::Read;
+
+            let mut bytes = Vec::new();
+            (&*file).read_to_end(&mut bytes)?;
+            Ok(Image::from_bytes(&bytes))
+        }
+    }
+
+    pub fn bytes(&self) -> &[u8] {
+        match self {
+            Image::Owned(words, len) => unsafe {
+                slice::from_raw_parts(words.as_ptr() as *const u8, *len)
+            },
+            #[cfg(unix)]
+            Image::Mapped(mapping) => unsafe {
+                slice::from_raw_parts(mapping.ptr as *const u8, mapping.len)
+            },
+        }
+    }
+
+    /// Checks everything `section` relies on, so the chunk doesn't have to on every access
+    pub fn header(&self) -> Result<Header, Box<dyn Error>> {
+        let bytes = self.bytes();
+
+        if !is_image(bytes) {
+            return Err("not a bytecode image".into());
+        }
+
+        if bytes.len() < mem::size_of::<Header>() {
+            return Err("truncated bytecode image".into());
+        }
+
+        let header = unsafe { (bytes.as_ptr() as *const Header).read_unaligned() };
+
+        if header.version != VERSION {
+            return Err(format!(
+                "bytecode image is version {}, this merc only runs version {}",
+                header.version, VERSION
+            )
+            .into());
+        }
+
+        if header.byte_order != BYTE_ORDER {
+            return Err(
+                "bytecode image was written on a machine with a different byte order".into(),
+            );
+        }
+
+        self.check::<crate::bytecode::Op>(header.code)?;
+        self.check::<i64>(header.integers)?;
+        self.check::<crate::bytecode::FunctionEntry>(header.functions)?;
+        self.check::<u32>(header.globals)?;
+        self.check::<StringSpan>(header.strings)?;
+        self.check::<u8>(header.string_bytes)?;
+
+        Ok(header)
+    }
+
+    fn check<T>(&self, section: Section) -> Result<(), Box<dyn Error>> {
+        let end = (section.count as usize)
+            .checked_mul(mem::size_of::<T>())
+            .and_then(|size| size.checked_add(section.offset as usize));
+
+        match end {
+            Some(end)
+                if end <= self.bytes().len()
+                    && section.offset as usize % mem::align_of::<T>() == 0 =>
+            {
+                Ok(())
+            }
+            _ => Err("bytecode image has a section out of bounds".into()),
+        }
+    }
+
+    /// Only for sections `header` has already checked
+    pub(crate) unsafe fn section<T>(&self, section: Section) -> &[T] {
+        if section.count == 0 {
+            &[]
+        } else {
+            slice::from_raw_parts(
+                self.bytes().as_ptr().add(section.offset as usize) as *const T,
+                section.count as usize,
+            )
+        }
+    }
+}
+
+/// A read-only private mapping of a whole file
+#[cfg(unix)]
+pub struct Mapping {
+    ptr: *mut libc::c_void,
+    len: usize,
+}
+
+// Nothing ever writes through it, so any thread can read it
+#[cfg(unix)]
+unsafe impl Send for Mapping {}
+#[cfg(unix)]
+unsafe impl Sync for Mapping {}
+
+#[cfg(unix)]
+impl Mapping {
+    pub fn new(file: &File) -> io::Result<Mapping> {
+        use std::os::unix::io::AsRawFd;
+
+        let len = file.metadata()?.len() as usize;
+
+        // mmap won't do empty mappings, and an empty file isn't an image anyway
+        if len == 0 {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidData,
+                "empty bytecode image",
+            ));
+        }
+
+        let ptr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                len,
+                libc::PROT_READ,
+                libc::MAP_PRIVATE,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+
+        if ptr == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+
+        Ok(Mapping { ptr, len })
+    }
+}
+
+#[cfg(unix)]
+impl Drop for Mapping {
+    fn drop(&mut self) {
+        unsafe { libc::munmap(self.ptr, self.len) };
+    }
+}
@@ -1,22 +1,30 @@
-use crate::value::Block;
-
 #[derive(Clone, Debug)]
 pub enum Instruction {
     Import,
+    /// The `code_size` instructions after it are the function's body, which needs `frame_size`
+    /// locals and at most `max_stack` values on the stack
     DefineFunction {
         param_count: u64,
         identifier: String,
+        code_size: u64,
+        frame_size: u64,
+        max_stack: u64,
     },
-    StartBlock,
-    EndBlock,
     Return,
+    /// `function` is the runtime's id for `identifier`, filled in when the module is linked
     CallKnownFunction {
         arg_count: u64,
         identifier: String,
+        function: u32,
     },
     CallUnknownFunction {
         arg_count: u64,
     },
+    /// Calls what the global in `slot` holds, or the function of the same name while it's null
+    CallDirectFunction {
+        arg_count: u64,
+        slot: u64,
+    },
     NullConst,
     BooleanConst(bool),
     IntegerConst(i64),
@@ -30,21 +38,55 @@ pub enum Instruction {
     SetLocal {
         local_idx: u64,
     },
+    /// Like `SetLocal`, but leaves the value on the stack
+    TeeLocal {
+        local_idx: u64,
+    },
     Drop,
-    If {
-        then: Block,
-        else_: Block,
+    /// Jumps `offset` instructions forwards
+    Jump {
+        offset: u64,
+    },
+    /// Jumps `offset` instructions forwards if the popped value isn't truthy
+    JumpIfFalse {
+        offset: u64,
     },
+    /// Jumps `offset` instructions backwards
     Loop {
-        block: Block,
-    },
-    /// [21:17] RazzBerry: Oh BreakIf is a misnomer
-    ///
-    /// It should be BreakIfNot
-    ///
-    ///[21:17] (one, day, tuples, will, rule): bruh
-    BreakIfNot,
+        offset: u64,
+    },
     Global,
     GetFree,
     SetFree,
+    GetGlobal {
+        slot: u64,
+    },
+    SetGlobal {
+        slot: u64,
+    },
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Mod,
+    Eq,
+    Ne,
+    Lt,
+    Le,
+    Gt,
+    Ge,
+    And,
+    Or,
+    Negate,
+    Not,
+    Index,
+    IndexSet,
+}
+
+/// A single compiled file. Its `GetGlobal`/`SetGlobal` slots index into `globals`, and get
+/// rewritten to the runtime's own slots when the module is loaded.
+#[derive(Clone, Debug, Default)]
+pub struct Module {
+    pub instructions: Vec<Instruction>,
+    pub globals: Vec<String>,
 }
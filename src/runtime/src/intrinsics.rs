@@ -126,6 +126,8 @@ pub mod funcs {
         let a = runtime.pop_value_from_stack();
 
         println!("{:#?}", a);
+
+        runtime.push_value_to_stack(Value::Null);
     }
 
     fn itoa(runtime: &mut Runtime) {
@@ -157,6 +159,8 @@ pub mod funcs {
 
         print!("{}", a.to_string());
         let _ = io::stdout().lock().flush();
+
+        runtime.push_value_to_stack(Value::Null);
     }
 
     fn prompt(runtime: &mut Runtime) {
@@ -192,6 +196,8 @@ pub mod funcs {
             }
             not_a_list => error!("Called insert on not a list: {:?}", not_a_list),
         };
+
+        runtime.push_value_to_stack(Value::Null);
     }
 
     fn delete(runtime: &mut Runtime) {
@@ -207,6 +213,8 @@ pub mod funcs {
             }
             _ => {}
         }
+
+        runtime.push_value_to_stack(Value::Null);
     }
 
     fn substr(runtime: &mut Runtime) {
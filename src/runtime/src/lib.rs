@@ -1,7 +1,11 @@
+pub mod bytecode;
+pub mod image;
 pub mod instruction;
 pub mod intrinsics;
 pub mod operators;
 pub mod runtime;
+pub mod threaded;
 pub mod value;
+pub mod verify;
 
 pub use intrinsics::INTRINSICS;
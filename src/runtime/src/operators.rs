@@ -9,10 +9,11 @@ pub mod ternary {
     pub const INDEX_SET: NativeFunction = NativeFunction {
         name: Cow::Borrowed("==[]"),
         arity: 3,
-        fun_ptr: index_set,
+        fun_ptr: call_index_set,
     };
 
-    fn index_set(runtime: &mut Runtime) {
+    /// The IndexSet instruction, which leaves nothing on the stack
+    pub(crate) fn index_set(runtime: &mut Runtime) {
         let idx = runtime.pop_value_from_stack().to_integer() as usize;
         let list = runtime.pop_value_from_stack();
         let value = runtime.pop_value_from_stack();
@@ -25,6 +26,12 @@ pub mod ternary {
             list[idx] = value;
         }
     }
+
+    /// `==[]` called as a function, which like any other call leaves a value behind
+    fn call_index_set(runtime: &mut Runtime) {
+        index_set(runtime);
+        runtime.push_value_to_stack(Value::Null);
+    }
 }
 
 pub mod binary {
@@ -122,7 +129,7 @@ pub mod binary {
         fun_ptr: index,
     };
 
-    fn index(runtime: &mut Runtime) {
+    pub(crate) fn index(runtime: &mut Runtime) {
         let idx = runtime.pop_value_from_stack().to_integer() as usize;
         let list = runtime.pop_value_from_stack();
 
@@ -131,10 +138,12 @@ pub mod binary {
             runtime.push_value_to_stack(list[idx].clone());
         } else if let Value::String(string) = list {
             runtime.push_value_to_stack(Value::String(string[idx..][..1].to_string()));
+        } else {
+            runtime.push_value_to_stack(Value::Null);
         }
     }
 
-    fn equal(runtime: &mut Runtime) {
+    pub(crate) fn equal(runtime: &mut Runtime) {
         let b = runtime.pop_value_from_stack();
         let a = runtime.pop_value_from_stack();
 
@@ -146,7 +155,7 @@ pub mod binary {
         })
     }
 
-    fn not_equal(runtime: &mut Runtime) {
+    pub(crate) fn not_equal(runtime: &mut Runtime) {
         let b = runtime.pop_value_from_stack();
         let a = runtime.pop_value_from_stack();
 
@@ -158,7 +167,7 @@ pub mod binary {
         })
     }
 
-    fn greater_than(runtime: &mut Runtime) {
+    pub(crate) fn greater_than(runtime: &mut Runtime) {
         let b = runtime.pop_value_from_stack();
         let a = runtime.pop_value_from_stack();
 
@@ -170,7 +179,7 @@ pub mod binary {
         })
     }
 
-    fn greater_than_or_equal(runtime: &mut Runtime) {
+    pub(crate) fn greater_than_or_equal(runtime: &mut Runtime) {
         let b = runtime.pop_value_from_stack();
         let a = runtime.pop_value_from_stack();
 
@@ -182,7 +191,7 @@ pub mod binary {
         })
     }
 
-    fn less_than(runtime: &mut Runtime) {
+    pub(crate) fn less_than(runtime: &mut Runtime) {
         let b = runtime.pop_value_from_stack();
         let a = runtime.pop_value_from_stack();
 
@@ -194,7 +203,7 @@ pub mod binary {
         })
     }
 
-    fn less_than_or_equal(runtime: &mut Runtime) {
+    pub(crate) fn less_than_or_equal(runtime: &mut Runtime) {
         let b = runtime.pop_value_from_stack();
         let a = runtime.pop_value_from_stack();
 
@@ -206,49 +215,49 @@ pub mod binary {
         })
     }
 
-    fn and(runtime: &mut Runtime) {
+    pub(crate) fn and(runtime: &mut Runtime) {
         let b = runtime.pop_value_from_stack();
         let a = runtime.pop_value_from_stack();
 
         runtime.push_value_to_stack(Boolean(a.truthy() && b.truthy()))
     }
 
-    fn or(runtime: &mut Runtime) {
+    pub(crate) fn or(runtime: &mut Runtime) {
         let b = runtime.pop_value_from_stack();
         let a = runtime.pop_value_from_stack();
 
         runtime.push_value_to_stack(Boolean(a.truthy() || b.truthy()))
     }
 
-    fn add(runtime: &mut Runtime) {
+    pub(crate) fn add(runtime: &mut Runtime) {
         let b = runtime.pop_value_from_stack();
         let a = runtime.pop_value_from_stack();
 
         runtime.push_value_to_stack(a.add(&b))
     }
 
-    fn sub(runtime: &mut Runtime) {
+    pub(crate) fn sub(runtime: &mut Runtime) {
         let b = runtime.pop_value_from_stack();
         let a = runtime.pop_value_from_stack();
 
         runtime.push_value_to_stack(a.subtraction(&b))
     }
 
-    fn multiply(runtime: &mut Runtime) {
+    pub(crate) fn multiply(runtime: &mut Runtime) {
         let b = runtime.pop_value_from_stack();
         let a = runtime.pop_value_from_stack();
 
         runtime.push_value_to_stack(a.multiply(&b))
     }
 
-    fn divide(runtime: &mut Runtime) {
+    pub(crate) fn divide(runtime: &mut Runtime) {
         let b = runtime.pop_value_from_stack();
         let a = runtime.pop_value_from_stack();
 
         runtime.push_value_to_stack(a.divide(&b))
     }
 
-    fn modulo(runtime: &mut Runtime) {
+    pub(crate) fn modulo(runtime: &mut Runtime) {
         let b = runtime.pop_value_from_stack();
         let a = runtime.pop_value_from_stack();
 
@@ -273,13 +282,13 @@ pub mod unary {
         fun_ptr: not,
     };
 
-    fn negate(runtime: &mut Runtime) {
+    pub(crate) fn negate(runtime: &mut Runtime) {
         let a = runtime.pop_value_from_stack();
 
         runtime.push_value_to_stack(a.negate())
     }
 
-    fn not(runtime: &mut Runtime) {
+    pub(crate) fn not(runtime: &mut Runtime) {
         let a = runtime.pop_value_from_stack();
         runtime.push_value_to_stack(a.negate())
     }
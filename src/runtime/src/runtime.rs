@@ -1,41 +1,69 @@
 use std::{
     cell::RefCell,
-    collections::HashSet,
+    collections::HashMap,
     error::Error,
-    mem,
     path::{Path, PathBuf},
     rc::Rc,
-    slice::Iter,
 };
 
 use crate::{
-    instruction::Instruction,
+    bytecode::Chunk,
+    instruction::{Instruction, Module},
+    operators::{binary, ternary, unary},
+    threaded::Frame,
     value::{Block, BytecodeFunction, Function, NativeFunction, Value},
+    verify::verify_module,
 };
 
 use tracing::error;
 
 pub struct Runtime {
     pub(crate) value_stack: Vec<Value>,
-    globals: Vec<(String, Value)>,
-    functions: HashSet<Function>,
-    pub(crate) function_stack: Vec<Function>,
-    block_stack: Vec<Block>,
+    globals: Vec<Value>,
+    global_slots: HashMap<String, u64>,
+    /// The function id of each global's name
+    slot_functions: Vec<u32>,
+    /// Every function, indexed by id. A name gets its id the first time anything links against
+    /// it, and the function shows up once it's defined. Intrinsics are defined before anything
+    /// else, so they have the first ids, in the order they were passed in.
+    functions: Vec<Option<Function>>,
+    /// Names to ids, for linking and for GetFree
+    function_ids: HashMap<String, u32>,
+    /// The callers of the running `BytecodeFunction`, innermost last
+    call_frames: Vec<CallFrame>,
+    pub(crate) frames: Vec<Frame>,
+    /// How many calls either engine lets be in progress at once
+    pub(crate) max_depth: usize,
+    /// Every call's locals, one window after another. The top window is the running call's.
+    pub(crate) locals: Vec<Value>,
     instruction_reader: InstructionReader,
     argv: Value,
     base_path: PathBuf,
-    pub(crate) return_value: Value,
 }
 
-type InstructionReader = Box<dyn Fn(&str, &Path) -> Result<Vec<Instruction>, Box<dyn Error>>>;
+/// What a caller in the instructions engine needs to pick back up where it left off once its
+/// callee returns
+#[derive(Debug)]
+struct CallFrame {
+    code: Rc<Block>,
+    return_pc: usize,
+    locals_base: usize,
+}
+
+/// How deep calls can go unless the embedder says otherwise. Neither engine recurses into Rust
+/// for a call, so this is only here to catch runaway recursion before it eats all the memory.
+pub const DEFAULT_MAX_DEPTH: usize = 100_000;
 
-#[derive(PartialEq, Eq, Hash, Debug, Clone, Copy)]
-pub enum BreakRequested {
-    Return,
-    Yes,
-    No,
+/// What a file compiles down to, depending on which engine is going to run it
+pub enum Program {
+    Instructions(Module),
+    Bytecode(Chunk),
 }
 
+/// Loads the file an `import` names. `None` means it has already been loaded once, and its body
+/// shouldn't run again.
+type InstructionReader = Box<dyn FnMut(&str, &Path) -> Result<Option<Program>, Box<dyn Error>>>;
+
 impl Runtime {
     pub fn create(
         instruction_reader: InstructionReader,
@@ -43,346 +71,506 @@ impl Runtime {
         argv: Value,
         base_path: PathBuf,
     ) -> Self {
-        let mut functions = HashSet::new();
+        let mut runtime = Self {
+            value_stack: vec![],
+            globals: vec![],
+            global_slots: HashMap::new(),
+            slot_functions: vec![],
+            functions: Vec::with_capacity(intrinsics.len()),
+            function_ids: HashMap::with_capacity(intrinsics.len()),
+            call_frames: vec![],
+            frames: vec![],
+            max_depth: DEFAULT_MAX_DEPTH,
+            locals: vec![],
+            instruction_reader,
+            argv,
+            base_path,
+        };
 
-        functions.reserve(intrinsics.len());
         for intrinsic in intrinsics {
-            if !functions.insert(Function::Native(intrinsic.clone())) {
+            if runtime.find_function(&intrinsic.name).is_some() {
                 error!(
                     "TO THE EMBEDDER OF THIS INTERPRETER: Intrinsics array has dupes, not cool bro"
                 )
             }
+
+            runtime.define_function(Function::Native(intrinsic.clone()));
         }
 
-        Self {
-            value_stack: vec![],
-            globals: vec![],
-            functions,
-            function_stack: vec![Function::Bytecode(BytecodeFunction {
-                name: "<top>".into(),
-                arity: 0,
-                code: Block::default(),
-                locals: vec![],
-            })],
-            block_stack: vec![],
-            instruction_reader,
-            argv,
-            base_path,
-            return_value: Value::Null,
+        runtime
+    }
+
+    pub fn set_max_depth(&mut self, max_depth: usize) {
+        self.max_depth = max_depth;
+    }
+
+    /// Called right before pushing a frame for a new call. Counts the callers of both engines, so
+    /// the limit is the same whichever one runs the program, and holds across calls that go from
+    /// one into the other.
+    pub(crate) fn check_depth(&self) {
+        if self.call_frames.len() + self.frames.len() >= self.max_depth {
+            panic!(
+                "Calls went more than {} deep, is something recursing forever?",
+                self.max_depth
+            );
         }
     }
 
-    pub fn execute_program(&mut self, insns: &[Instruction]) {
-        self.execute_insns(insns);
+    pub fn execute_program(&mut self, program: Program) {
+        match program {
+            Program::Instructions(module) => {
+                let insns = self.link_module(module);
+                self.execute_insns(Rc::new(Block(insns)));
+            }
+            Program::Bytecode(chunk) => {
+                let chunk = self.link_chunk(chunk);
+                self.execute_chunk(chunk);
+            }
+        }
 
-        if let Some(func) = self.functions.iter().find(|f| f.name() == "main") {
+        if let Some(func) = self.find_function("main") {
             if func.is_bytecode() {
                 let func = func.clone();
                 self.value_stack.push(self.argv.clone());
+                self.fit_args(1, func.arity());
                 self.execute_function(func);
             }
         }
     }
 
+    /// Calls `func` with the arguments on top of the stack, which `fit_args` has already made
+    /// exactly as many as it takes
     pub fn execute_function(&mut self, func: Function) {
         match func {
             Function::Bytecode(bytecode) => {
-                let mut new_bytecode = bytecode.clone();
-                for _ in 0..bytecode.arity {
-                    let arg = self.pop_value_from_stack();
-                    new_bytecode.locals.insert(0, arg);
-                }
-                self.function_stack.push(Function::Bytecode(new_bytecode));
-                let old_value_stack_size = self.value_stack.len();
-                self.execute_insns(&bytecode.code.0);
-                let r#return = mem::replace(&mut self.return_value, Value::Null);
-                while self.value_stack.len() > old_value_stack_size {
-                    if self.value_stack.is_empty() {
-                        break;
-                    }
-                    self.value_stack.pop();
-                }
-                self.push_value_to_stack(r#return);
+                let locals_base =
+                    self.enter_frame(bytecode.arity, bytecode.frame_size, bytecode.max_stack);
+                self.run_insns(bytecode.code, locals_base);
             }
             Function::Native(native) => {
                 (native.fun_ptr)(self);
             }
+            Function::Compiled(compiled) => self.call_compiled(compiled),
         }
     }
 
-    pub fn execute_insns(&mut self, insns: &[Instruction]) -> BreakRequested {
-        let mut insns_iter = insns.iter();
-        'main: while let Some(insn) = insns_iter.next() {
-            match insn {
-                Instruction::Import => {
-                    let path = self.value_stack.pop().map(|v| v.to_string()).unwrap();
-                    let imported_insns =
-                        (self.instruction_reader)(&path[1..][..path.len() - 2], &self.base_path);
-                    self.execute_program(&imported_insns.unwrap())
-                }
-                Instruction::DefineFunction {
-                    param_count: _,
-                    identifier: _,
-                } => { /* handled by build_block */ }
-                Instruction::StartBlock => {
-                    self.build_block(&mut insns_iter);
-                }
-                Instruction::EndBlock => {}
-                Instruction::Return => {
-                    self.return_value = self.value_stack.pop().unwrap_or(Value::Null);
-                    self.function_stack.pop();
-                    return BreakRequested::Return;
-                }
-                Instruction::CallKnownFunction {
-                    arg_count,
-                    identifier,
-                } => {
-                    let mut func = None;
-                    for function in self.functions.iter() {
-                        if function.name() == identifier {
-                            func = Some(function.clone());
-                            break;
-                        }
-                    }
-                    let mut func = func.unwrap();
-
-                    if let Function::Bytecode(func) = &mut func {
-                        func.locals.reserve(*arg_count as usize);
+    /// Turns the `arg_count` arguments a call pushed into the `arity` its callee takes, dropping
+    /// the extra ones and passing null for the missing ones. Codegen counted on the call taking
+    /// exactly `arg_count` values off the stack, whatever it ends up calling.
+    pub(crate) fn fit_args(&mut self, arg_count: u64, arity: u64) {
+        if arg_count != arity {
+            let args = self.value_stack.len() - arg_count as usize;
+            self.value_stack.resize(args + arity as usize, Value::Null);
+        }
+    }
 
-                        for i in 0..*arg_count {
-                            func.set_local(i, self.value_stack.pop().unwrap_or(Value::Null));
-                        }
-                    }
+    /// Moves the arguments off the stack to become the first locals of a new window of
+    /// `frame_size` locals, and returns where that window starts. The arguments are already in
+    /// order on top of the stack, so they go over in one move. The callee never has more than
+    /// `max_stack` values of its own on the stack, so that's made room for up front.
+    pub(crate) fn enter_frame(&mut self, arity: u64, frame_size: u64, max_stack: u64) -> usize {
+        let locals_base = self.locals.len();
+        let args = self.value_stack.len() - arity as usize;
+        self.locals.extend(self.value_stack.drain(args..));
+        self.locals
+            .resize(locals_base + frame_size as usize, Value::Null);
+        self.value_stack.reserve(max_stack as usize);
+        locals_base
+    }
 
-                    self.execute_function(func);
-                }
-                Instruction::CallUnknownFunction { arg_count } => {
-                    let function = match self.value_stack.pop().unwrap() {
-                        Value::Function(func) => {
-                            if func.arity() != *arg_count {
-                                let based_func = self
-                                    .functions
-                                    .iter()
-                                    .find(|f| f.name() == func.name() && f.arity() == *arg_count)
-                                    .cloned()
-                                    .unwrap();
-                                based_func
-                            } else {
-                                func
-                            }
-                        }
-                        var => panic!(
-                            "\n{}\n\nfunction_stack: {:#?}\n\n\nglobals: {:#?}",
-                            var.to_string(),
-                            self.function_stack,
-                            self.globals
-                        ),
-                    };
-
-                    self.execute_function(function);
-                }
-                Instruction::NullConst => self.value_stack.push(Value::Null),
-                Instruction::BooleanConst(val) => self.value_stack.push(Value::Boolean(*val)),
-                Instruction::IntegerConst(val) => self.value_stack.push(Value::Integer(*val)),
-                Instruction::StringConst(val) => self.value_stack.push(Value::String(val.clone())),
-                Instruction::ListCount { count } => {
-                    let mut list = vec![];
-                    let mut count_too_big = false;
-                    for _ in 0..*count {
-                        match self.value_stack.pop() {
-                            Some(val) => list.insert(0, val),
-                            None => count_too_big = true,
-                        }
-                    }
+    /// Runs a module's top level, which defines its functions and runs its imports
+    fn execute_insns(&mut self, insns: Rc<Block>) {
+        let locals_base = self.locals.len();
+        self.run_insns(insns, locals_base);
+    }
 
-                    if count_too_big {
-                        error!(
-                            "Tried making a {} long list, but only {} values were on the stack",
-                            count,
-                            list.len()
-                        );
-                    }
+    /// Runs `code` from the start until it returns. Calls to other `BytecodeFunction`s push a
+    /// `CallFrame` and carry on in the same loop, so only calls coming in from outside (`main`,
+    /// imports, the threaded engine) nest in Rust.
+    fn run_insns(&mut self, mut code: Rc<Block>, mut locals_base: usize) {
+        let floor = self.call_frames.len();
+        let mut pc = 0;
+
+        loop {
+            // Only calling into (or returning to) another function gets us back up here
+            let current = code.clone();
+            let insns = &current.0;
+
+            'dispatch: loop {
+                let insn = match insns.get(pc) {
+                    Some(insn) => insn,
+                    None => return,
+                };
 
-                    self.value_stack
-                        .push(Value::List(Rc::new(RefCell::new(list))));
-                }
-                Instruction::GetLocal { local_idx } => {
-                    let value = self.function_stack.last().unwrap().get_local(*local_idx);
-                    self.value_stack.push(value);
-                }
-                Instruction::SetLocal { local_idx } => {
-                    self.function_stack.last_mut().unwrap().set_local(
-                        *local_idx,
-                        self.value_stack.last().cloned().unwrap_or(Value::Null),
-                    )
-                }
-                Instruction::Drop => self.value_stack.pop().map_or((), |_| ()),
-                Instruction::If { then, else_ } => {
-                    let old_value_stack_size = self.value_stack.len();
-                    let break_requested =
-                        if self.value_stack.pop().map(|v| v.truthy()).unwrap_or(false) {
-                            self.execute_insns(&then.0)
-                        } else {
-                            self.execute_insns(&else_.0)
+                match insn {
+                    Instruction::Import => self.import(),
+                    Instruction::DefineFunction {
+                        param_count,
+                        identifier,
+                        code_size,
+                        frame_size,
+                        max_stack,
+                    } => {
+                        let body = pc + 1..pc + 1 + *code_size as usize;
+                        let bytecode = BytecodeFunction {
+                            name: identifier.as_str().into(),
+                            arity: *param_count,
+                            frame_size: *frame_size,
+                            max_stack: *max_stack,
+                            code: Rc::new(Block(insns[body.clone()].to_vec())),
                         };
 
-                    while self.value_stack.len() >= old_value_stack_size {
-                        if self.value_stack.is_empty() {
-                            break;
-                        }
-                        self.value_stack.pop();
-                    }
+                        self.define_function(Function::Bytecode(bytecode));
 
-                    if break_requested != BreakRequested::No {
-                        return break_requested;
+                        pc = body.end;
+                        continue;
                     }
-                }
-                Instruction::Loop { block } => loop {
-                    let old_value_stack_size = self.value_stack.len();
-                    let break_requested = self.execute_insns(&block.0);
-                    if break_requested == BreakRequested::Yes {
-                        while self.value_stack.len() >= old_value_stack_size {
-                            if self.value_stack.is_empty() {
-                                break;
-                            }
+                    Instruction::Return => {
+                        // Codegen made sure the value being returned is the only thing this call
+                        // left on the stack, so it's already right where the caller wants it
+                        self.locals.truncate(locals_base);
 
-                            self.value_stack.pop();
+                        if self.call_frames.len() == floor {
+                            return;
                         }
-                        break;
+
+                        let frame = self.call_frames.pop().unwrap();
+                        pc = frame.return_pc;
+                        locals_base = frame.locals_base;
+                        code = frame.code;
+                        break 'dispatch;
                     }
-                    while self.value_stack.len() >= old_value_stack_size {
-                        if self.value_stack.is_empty() {
-                            break;
+                    Instruction::CallKnownFunction { .. }
+                    | Instruction::CallUnknownFunction { .. }
+                    | Instruction::CallDirectFunction { .. } => {
+                        let (callee, arg_count) = match insn {
+                            Instruction::CallKnownFunction {
+                                function,
+                                arg_count,
+                                ..
+                            } => (self.function(*function).cloned().unwrap(), *arg_count),
+                            Instruction::CallUnknownFunction { arg_count } => {
+                                (self.pop_callee(*arg_count), *arg_count)
+                            }
+                            Instruction::CallDirectFunction { arg_count, slot } => {
+                                (self.direct_callee(*slot, *arg_count), *arg_count)
+                            }
+                            _ => unreachable!(),
+                        };
+                        self.fit_args(arg_count, callee.arity());
+
+                        match callee {
+                            Function::Bytecode(callee) => {
+                                self.check_depth();
+                                self.call_frames.push(CallFrame {
+                                    code: current.clone(),
+                                    return_pc: pc + 1,
+                                    locals_base,
+                                });
+
+                                locals_base = self.enter_frame(
+                                    callee.arity,
+                                    callee.frame_size,
+                                    callee.max_stack,
+                                );
+                                pc = 0;
+                                code = callee.code;
+                                break 'dispatch;
+                            }
+                            other => self.execute_function(other),
                         }
-
-                        self.value_stack.pop();
                     }
-                    if break_requested == BreakRequested::Return {
-                        return BreakRequested::Return;
+                    Instruction::NullConst => self.value_stack.push(Value::Null),
+                    Instruction::BooleanConst(val) => self.value_stack.push(Value::Boolean(*val)),
+                    Instruction::IntegerConst(val) => self.value_stack.push(Value::Integer(*val)),
+                    Instruction::StringConst(val) => {
+                        self.value_stack.push(Value::String(val.clone()))
                     }
-                },
-                Instruction::BreakIfNot => {
-                    if !self.value_stack.pop().map(|v| v.truthy()).unwrap_or(true) {
-                        return BreakRequested::Yes;
+                    Instruction::ListCount { count } => self.make_list(*count),
+                    Instruction::GetLocal { local_idx } => {
+                        let value = unsafe { self.local(locals_base, *local_idx as usize) }.clone();
+                        self.value_stack.push(value);
                     }
-                }
-                Instruction::Global => {
-                    let ident = self.value_stack.pop().unwrap().to_string();
-                    self.globals.push((ident, Value::Null));
-                }
-                Instruction::GetFree => {
-                    let ident = self.value_stack.pop().map(|v| v.to_string());
-                    match ident {
-                        Some(ident) => {
-                            'inner: for (name, global) in self.globals.iter() {
-                                if name == &ident {
-                                    if matches!(global, Value::Null) {
-                                        break 'inner;
-                                    }
-
-                                    self.value_stack.push(global.clone());
-                                    continue 'main;
-                                }
-                            }
-
-                            let function = self
-                                .functions
-                                .iter()
-                                .find(|f| f.name() == &ident)
-                                .map(|f| Value::Function(f.clone()))
-                                .unwrap_or(Value::Null);
-
-                            self.value_stack.push(function);
-                        }
-                        None => self.value_stack.push(Value::Null),
+                    Instruction::SetLocal { local_idx } => unsafe {
+                        let value = self.pop_verified();
+                        *self.local(locals_base, *local_idx as usize) = value;
+                    },
+                    Instruction::TeeLocal { local_idx } => unsafe {
+                        let value = self.top_verified().clone();
+                        *self.local(locals_base, *local_idx as usize) = value;
+                    },
+                    Instruction::Drop => drop(unsafe { self.pop_verified() }),
+                    Instruction::Jump { offset } => {
+                        pc += *offset as usize;
+                        continue;
                     }
-                }
-                Instruction::SetFree => {
-                    let ident = self.value_stack.pop().map(|v| v.to_string());
-                    let value = self.value_stack.pop().unwrap_or(Value::Null);
-
-                    if let Some(ident) = ident {
-                        for (name, global) in self.globals.iter_mut() {
-                            if name == &ident {
-                                *global = value;
-                                continue 'main;
-                            }
+                    Instruction::JumpIfFalse { offset } => {
+                        if !unsafe { self.pop_verified() }.truthy() {
+                            pc += *offset as usize;
+                            continue;
                         }
-                        self.globals.push((ident, value));
                     }
+                    Instruction::Loop { offset } => {
+                        pc -= *offset as usize;
+                        continue;
+                    }
+                    Instruction::Global => self.declare_global(),
+                    Instruction::GetFree => self.get_free(),
+                    Instruction::SetFree => self.set_free(),
+                    Instruction::GetGlobal { slot } => self.get_global(*slot),
+                    Instruction::SetGlobal { slot } => self.set_global(*slot),
+                    Instruction::Add => binary::add(self),
+                    Instruction::Sub => binary::sub(self),
+                    Instruction::Mul => binary::multiply(self),
+                    Instruction::Div => binary::divide(self),
+                    Instruction::Mod => binary::modulo(self),
+                    Instruction::Eq => binary::equal(self),
+                    Instruction::Ne => binary::not_equal(self),
+                    Instruction::Lt => binary::less_than(self),
+                    Instruction::Le => binary::less_than_or_equal(self),
+                    Instruction::Gt => binary::greater_than(self),
+                    Instruction::Ge => binary::greater_than_or_equal(self),
+                    Instruction::And => binary::and(self),
+                    Instruction::Or => binary::or(self),
+                    Instruction::Negate => unary::negate(self),
+                    Instruction::Not => unary::not(self),
+                    Instruction::Index => binary::index(self),
+                    Instruction::IndexSet => ternary::index_set(self),
                 }
+
+                pc += 1;
+            }
+        }
+    }
+
+    /// Gives the module's globals their program-wide slots, and patches its instructions to use them
+    fn link_module(&mut self, module: Module) -> Vec<Instruction> {
+        // Both engines run loaded code without checking it again, so this has to hold first
+        if let Err(why) = verify_module(&module) {
+            panic!("Refusing to run a module that doesn't verify: {}", why);
+        }
+
+        let slots = module
+            .globals
+            .iter()
+            .map(|name| self.global_slot(name))
+            .collect::<Vec<_>>();
+
+        let mut insns = module.instructions;
+        for insn in insns.iter_mut() {
+            match insn {
+                Instruction::GetGlobal { slot }
+                | Instruction::SetGlobal { slot }
+                | Instruction::CallDirectFunction { slot, .. } => *slot = slots[*slot as usize],
+                Instruction::CallKnownFunction {
+                    identifier,
+                    function,
+                    ..
+                } => *function = self.function_id(identifier),
+                _ => {}
             }
         }
 
-        BreakRequested::No
+        insns
     }
 
-    pub fn pop_value_from_stack(&mut self) -> Value {
-        self.value_stack.pop().unwrap_or(Value::Null)
+    pub(crate) fn import(&mut self) {
+        let path = self.value_stack.pop().map(|v| v.to_string()).unwrap();
+        let imported = (self.instruction_reader)(&path[1..][..path.len() - 2], &self.base_path);
+        if let Some(program) = imported.unwrap() {
+            self.execute_program(program)
+        }
     }
 
-    pub fn push_value_to_stack(&mut self, value: Value) {
-        self.value_stack.push(value)
+    /// The id `name` has in the function table, which it's given the first time it's asked for
+    pub(crate) fn function_id(&mut self, name: &str) -> u32 {
+        if let Some(&id) = self.function_ids.get(name) {
+            return id;
+        }
+
+        let id = self.functions.len() as u32;
+        self.functions.push(None);
+        self.function_ids.insert(name.into(), id);
+        id
     }
 
-    pub fn build_block(&mut self, insns_iter: &mut Iter<Instruction>) {
-        self.block_stack.push(Block::default());
+    /// Functions can't be redefined, whatever got a name first keeps it
+    pub(crate) fn define_function(&mut self, function: Function) {
+        let id = self.function_id(function.name()) as usize;
+        if self.functions[id].is_none() {
+            self.functions[id] = Some(function);
+        }
+    }
 
-        while let Some(insn) = insns_iter.next() {
-            if matches!(insn, &Instruction::StartBlock) {
-                self.block_stack.push(Block::default())
-            } else if let Instruction::If { then, else_ } = insn {
-                let else_ = if else_.0.is_empty() {
-                    self.block_stack.pop().unwrap()
-                } else {
-                    else_.clone()
-                };
+    pub(crate) fn function(&self, id: u32) -> Option<&Function> {
+        self.functions[id as usize].as_ref()
+    }
 
-                let then = if then.0.is_empty() {
-                    self.block_stack.pop().unwrap()
-                } else {
-                    then.clone()
-                };
+    pub(crate) fn find_function(&self, name: &str) -> Option<&Function> {
+        self.function_ids
+            .get(name)
+            .and_then(|&id| self.function(id))
+    }
 
-                self.block_stack
-                    .last_mut()
-                    .unwrap()
-                    .0
-                    .push(Instruction::If { then, else_ })
-            } else if let Instruction::Loop { block } = insn {
-                let block = if block.0.is_empty() {
-                    self.block_stack.pop().unwrap()
-                } else {
-                    block.clone()
-                };
+    /// Pops the function a CallUnknown is calling
+    pub(crate) fn pop_callee(&mut self, arg_count: u64) -> Function {
+        let callee = self.value_stack.pop().unwrap();
+        self.callee(callee, arg_count)
+    }
 
-                self.block_stack
-                    .last_mut()
-                    .unwrap()
-                    .0
-                    .push(Instruction::Loop { block });
-            } else if let Instruction::DefineFunction {
-                param_count,
-                identifier,
-            } = insn
-            {
-                let bytecode = BytecodeFunction {
-                    name: identifier.clone(),
-                    arity: *param_count,
-                    code: self.block_stack.pop().unwrap(),
-                    locals: vec![],
-                };
+    /// What a CallDirect calls, which is what GetGlobal would have pushed for CallUnknown to pop
+    pub(crate) fn direct_callee(&mut self, slot: u64, arg_count: u64) -> Function {
+        let callee = match &self.globals[slot as usize] {
+            Value::Null => self
+                .function(self.slot_functions[slot as usize])
+                .map(|f| Value::Function(f.clone()))
+                .unwrap_or(Value::Null),
+            value => value.clone(),
+        };
+
+        self.callee(callee, arg_count)
+    }
 
-                self.functions.insert(Function::Bytecode(bytecode));
+    /// Calling something that isn't a function, or with the wrong number of arguments, is fatal
+    fn callee(&self, callee: Value, arg_count: u64) -> Function {
+        match callee {
+            Value::Function(func) => {
+                // There's only ever one function per name, so there's nothing else to try
+                if func.arity() != arg_count {
+                    panic!(
+                        "{} takes {} arguments, but was called with {}",
+                        func.name(),
+                        func.arity(),
+                        arg_count
+                    );
+                }
 
-                return;
-            } else {
-                self.block_stack
-                    .last_mut()
-                    .unwrap()
-                    .0
-                    .push(insn.clone().into());
+                func
             }
+            var => panic!(
+                "\n{}\n\nlocals: {:#?}\n\n\nglobals: {:#?}",
+                var.to_string(),
+                self.locals,
+                self.globals
+            ),
         }
     }
+
+    /// The elements are already in order on top of the stack, so they move over in one go, into a
+    /// list allocated at exactly the size ListConst asked for. Verified code always has all of
+    /// them there.
+    pub(crate) fn make_list(&mut self, count: u64) {
+        debug_assert!(self.value_stack.len() >= count as usize);
+        let start = self.value_stack.len() - count as usize;
+        let list: Vec<Value> = self.value_stack.drain(start..).collect();
+
+        self.value_stack
+            .push(Value::List(Rc::new(RefCell::new(list))));
+    }
+
+    pub(crate) fn declare_global(&mut self) {
+        let ident = self.value_stack.pop().unwrap().to_string();
+        self.global_slot(&ident);
+    }
+
+    pub(crate) fn get_free(&mut self) {
+        let ident = self.value_stack.pop().map(|v| v.to_string());
+        match ident {
+            Some(ident) => {
+                let slot = self.global_slots.get(&ident).copied();
+                match slot {
+                    Some(slot) => self.get_global(slot),
+                    None => {
+                        let function = self.find_function_value(&ident);
+                        self.value_stack.push(function);
+                    }
+                }
+            }
+            None => self.value_stack.push(Value::Null),
+        }
+    }
+
+    pub(crate) fn set_free(&mut self) {
+        let ident = self.value_stack.pop().map(|v| v.to_string());
+        let value = self.value_stack.pop().unwrap_or(Value::Null);
+
+        if let Some(ident) = ident {
+            let slot = self.global_slot(&ident);
+            self.globals[slot as usize] = value;
+        }
+    }
+
+    pub(crate) fn global_slot(&mut self, name: &str) -> u64 {
+        if let Some(slot) = self.global_slots.get(name) {
+            return *slot;
+        }
+
+        let slot = self.globals.len() as u64;
+        let function = self.function_id(name);
+        self.globals.push(Value::Null);
+        self.slot_functions.push(function);
+        self.global_slots.insert(name.into(), slot);
+        slot
+    }
+
+    /// Globals that are still null fall back to the function of the same name
+    pub(crate) fn get_global(&mut self, slot: u64) {
+        let value = match &self.globals[slot as usize] {
+            Value::Null => self
+                .function(self.slot_functions[slot as usize])
+                .map(|f| Value::Function(f.clone()))
+                .unwrap_or(Value::Null),
+            value => value.clone(),
+        };
+
+        self.value_stack.push(value);
+    }
+
+    pub(crate) fn set_global(&mut self, slot: u64) {
+        self.globals[slot as usize] = self.value_stack.pop().unwrap_or(Value::Null);
+    }
+
+    fn find_function_value(&self, name: &str) -> Value {
+        self.find_function(name)
+            .map(|f| Value::Function(f.clone()))
+            .unwrap_or(Value::Null)
+    }
+
+    /// Codegen checked that nothing pops more than it pushed, so there's always something here
+    pub fn pop_value_from_stack(&mut self) -> Value {
+        self.value_stack.pop().unwrap()
+    }
+
+    /// What the program left behind once `execute_program` is done, for the embedder to exit
+    /// with. A file without a `main` doesn't leave anything, which counts as null.
+    pub fn exit_value(&mut self) -> Value {
+        self.value_stack.pop().unwrap_or(Value::Null)
+    }
+
+    /// `pop_value_from_stack` for the engines, which only run code `verify` accepted. It never
+    /// pops what isn't there.
+    #[inline(always)]
+    pub(crate) unsafe fn pop_verified(&mut self) -> Value {
+        debug_assert!(!self.value_stack.is_empty());
+        self.value_stack.pop().unwrap_unchecked()
+    }
+
+    /// Same for peeking at the top of the stack
+    #[inline(always)]
+    pub(crate) unsafe fn top_verified(&self) -> &Value {
+        debug_assert!(!self.value_stack.is_empty());
+        self.value_stack.last().unwrap_unchecked()
+    }
+
+    /// A local of the frame starting at `locals_base`. Verified code only ever asks for ones below
+    /// its frame size, and `enter_frame` made room for all of those.
+    #[inline(always)]
+    pub(crate) unsafe fn local(&mut self, locals_base: usize, index: usize) -> &mut Value {
+        debug_assert!(locals_base + index < self.locals.len());
+        self.locals.get_unchecked_mut(locals_base + index)
+    }
+
+    pub fn push_value_to_stack(&mut self, value: Value) {
+        self.value_stack.push(value)
+    }
 }
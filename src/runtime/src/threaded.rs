@@ -0,0 +1,224 @@
+//! The engine for `Program::Bytecode`. Everything it runs is a flat array of 8 byte `Op`s, and
+//! calls between bytecode functions push a `Frame` instead of recursing into Rust, so the hot loop
+//! in `run` only ever has to look at one opcode byte to know what to do next.
+
+use std::rc::Rc;
+
+use crate::{
+    bytecode::{opcode, Chunk},
+    operators::{binary, ternary, unary},
+    runtime::Runtime,
+    value::{CompiledFunction, Function, Value},
+};
+
+/// What a caller needs to pick back up where it left off once its callee returns
+pub(crate) struct Frame {
+    chunk: Rc<Chunk>,
+    return_pc: usize,
+    locals_base: usize,
+}
+
+impl Runtime {
+    /// Gives the chunk's globals their program-wide slots, and the functions it calls by name
+    /// their ids. Unlike `link_module` the code itself is left alone, GetGlobal/SetGlobal and
+    /// CallKnown look theirs up in `global_slots` and `known_functions` instead.
+    pub(crate) fn link_chunk(&mut self, mut chunk: Chunk) -> Rc<Chunk> {
+        chunk.global_slots = chunk
+            .globals()
+            .iter()
+            .map(|&name| self.global_slot(chunk.string(name)))
+            .collect();
+
+        let mut known_functions = vec![u32::MAX; chunk.string_count()];
+        for op in chunk.code() {
+            if op.opcode == opcode::CALL_KNOWN {
+                known_functions[op.operand as usize] = self.function_id(chunk.string(op.operand));
+            }
+        }
+        chunk.known_functions = known_functions;
+
+        Rc::new(chunk)
+    }
+
+    /// Runs a chunk's top level, which defines its functions and runs its imports
+    pub(crate) fn execute_chunk(&mut self, chunk: Rc<Chunk>) {
+        let locals_base = self.locals.len();
+        self.run(chunk, 0, locals_base);
+    }
+
+    /// Pops the arguments, runs the function until it returns, and pushes what it returned
+    pub fn call_compiled(&mut self, func: CompiledFunction) {
+        let entry = func.chunk.functions()[func.index as usize];
+        let pc = entry.start as usize;
+        let locals_base =
+            self.enter_frame(func.arity, entry.frame_size as u64, entry.max_stack as u64);
+        self.run(func.chunk, pc, locals_base);
+    }
+
+    fn run(&mut self, mut chunk: Rc<Chunk>, mut pc: usize, mut locals_base: usize) {
+        let floor = self.frames.len();
+
+        loop {
+            // Only calling into (or returning to) another file's code gets us back up here
+            let current = chunk.clone();
+            let code = current.code();
+
+            'dispatch: loop {
+                let op = match code.get(pc) {
+                    Some(op) => *op,
+                    None => return,
+                };
+
+                match op.opcode {
+                    opcode::IMPORT => self.import(),
+                    opcode::DEFINE_FUNCTION => {
+                        let entry = &current.functions()[op.operand as usize];
+                        self.define_function(Function::Compiled(CompiledFunction {
+                            name: current.string(entry.ident).into(),
+                            arity: entry.parm_count as u64,
+                            chunk: current.clone(),
+                            index: op.operand,
+                        }));
+
+                        pc = (entry.start + entry.size) as usize;
+                        continue 'dispatch;
+                    }
+                    opcode::RETURN => {
+                        // Codegen made sure the value being returned is the only thing this call
+                        // left on the stack
+                        self.locals.truncate(locals_base);
+
+                        if self.frames.len() == floor {
+                            return;
+                        }
+
+                        let frame = self.frames.pop().unwrap();
+                        pc = frame.return_pc;
+                        locals_base = frame.locals_base;
+
+                        if Rc::ptr_eq(&frame.chunk, &current) {
+                            continue 'dispatch;
+                        } else {
+                            chunk = frame.chunk;
+                            break 'dispatch;
+                        }
+                    }
+                    opcode::CALL_KNOWN | opcode::CALL_UNKNOWN | opcode::CALL_DIRECT => {
+                        let (callee, arg_count) = match op.opcode {
+                            opcode::CALL_KNOWN => {
+                                let id = current.known_functions[op.operand as usize];
+                                (self.function(id).cloned().unwrap(), op.count as u64)
+                            }
+                            opcode::CALL_UNKNOWN => {
+                                (self.pop_callee(op.operand as u64), op.operand as u64)
+                            }
+                            _ => {
+                                let slot = unsafe {
+                                    *current.global_slots.get_unchecked(op.operand as usize)
+                                };
+                                (self.direct_callee(slot, op.count as u64), op.count as u64)
+                            }
+                        };
+                        self.fit_args(arg_count, callee.arity());
+
+                        match callee {
+                            Function::Compiled(callee) => {
+                                self.check_depth();
+                                self.frames.push(Frame {
+                                    chunk: current.clone(),
+                                    return_pc: pc + 1,
+                                    locals_base,
+                                });
+
+                                let entry = callee.chunk.functions()[callee.index as usize];
+                                locals_base = self.enter_frame(
+                                    callee.arity,
+                                    entry.frame_size as u64,
+                                    entry.max_stack as u64,
+                                );
+                                pc = entry.start as usize;
+
+                                if Rc::ptr_eq(&callee.chunk, &current) {
+                                    continue 'dispatch;
+                                } else {
+                                    chunk = callee.chunk;
+                                    break 'dispatch;
+                                }
+                            }
+                            other => self.execute_function(other),
+                        }
+                    }
+                    opcode::NULL_CONST => self.value_stack.push(Value::Null),
+                    opcode::BOOLEAN_CONST => self.value_stack.push(Value::Boolean(op.operand != 0)),
+                    opcode::INTEGER_CONST => {
+                        let value =
+                            unsafe { *current.integers().get_unchecked(op.operand as usize) };
+                        self.value_stack.push(Value::Integer(value))
+                    }
+                    opcode::STRING_CONST => {
+                        let value = current.string(op.operand).to_string();
+                        self.value_stack.push(Value::String(value))
+                    }
+                    opcode::LIST_CONST => self.make_list(op.operand as u64),
+                    opcode::GET_LOCAL => {
+                        let value = unsafe { self.local(locals_base, op.operand as usize) }.clone();
+                        self.value_stack.push(value)
+                    }
+                    opcode::SET_LOCAL | opcode::TEE_LOCAL => unsafe {
+                        let value = if op.opcode == opcode::SET_LOCAL {
+                            self.pop_verified()
+                        } else {
+                            self.top_verified().clone()
+                        };
+
+                        *self.local(locals_base, op.operand as usize) = value;
+                    },
+                    opcode::DROP => drop(unsafe { self.pop_verified() }),
+                    opcode::JUMP => {
+                        pc += op.operand as usize;
+                        continue 'dispatch;
+                    }
+                    opcode::JUMP_IF_FALSE => {
+                        if !unsafe { self.pop_verified() }.truthy() {
+                            pc += op.operand as usize;
+                            continue 'dispatch;
+                        }
+                    }
+                    opcode::LOOP => {
+                        pc -= op.operand as usize;
+                        continue 'dispatch;
+                    }
+                    opcode::GLOBAL => self.declare_global(),
+                    opcode::GET_FREE => self.get_free(),
+                    opcode::SET_FREE => self.set_free(),
+                    opcode::GET_GLOBAL => self.get_global(unsafe {
+                        *current.global_slots.get_unchecked(op.operand as usize)
+                    }),
+                    opcode::SET_GLOBAL => self.set_global(unsafe {
+                        *current.global_slots.get_unchecked(op.operand as usize)
+                    }),
+                    opcode::ADD => binary::add(self),
+                    opcode::SUB => binary::sub(self),
+                    opcode::MUL => binary::multiply(self),
+                    opcode::DIV => binary::divide(self),
+                    opcode::MOD => binary::modulo(self),
+                    opcode::EQ => binary::equal(self),
+                    opcode::NE => binary::not_equal(self),
+                    opcode::LT => binary::less_than(self),
+                    opcode::LE => binary::less_than_or_equal(self),
+                    opcode::GT => binary::greater_than(self),
+                    opcode::GE => binary::greater_than_or_equal(self),
+                    opcode::AND => binary::and(self),
+                    opcode::OR => binary::or(self),
+                    opcode::NEGATE => unary::negate(self),
+                    opcode::NOT => unary::not(self),
+                    opcode::INDEX => binary::index(self),
+                    opcode::INDEX_SET => ternary::index_set(self),
+                    unk => panic!("Found unknown opcode {} at {}", unk, pc),
+                }
+
+                pc += 1;
+            }
+        }
+    }
+}
@@ -8,7 +8,7 @@ use std::{
     rc::Rc,
 };
 
-use crate::{instruction::Instruction, runtime::Runtime};
+use crate::{bytecode::Chunk, instruction::Instruction, runtime::Runtime};
 
 #[derive(Clone, Debug)]
 pub enum Value {
@@ -24,26 +24,15 @@ pub enum Value {
 pub enum Function {
     Bytecode(BytecodeFunction),
     Native(NativeFunction),
+    Compiled(CompiledFunction),
 }
 
 impl Function {
-    pub fn get_local(&self, local_idx: u64) -> Value {
-        match self {
-            Function::Bytecode(bytecode) => bytecode.get_local(local_idx),
-            Function::Native(_) => Value::Null,
-        }
-    }
-
-    pub fn set_local(&mut self, local_idx: u64, val: Value) {
-        if let Self::Bytecode(bytecode) = self {
-            bytecode.set_local(local_idx, val)
-        }
-    }
-
     pub fn name(&self) -> &str {
         match self {
             Function::Bytecode(bytecode) => &bytecode.name,
             Function::Native(native) => native.name.borrow(),
+            Function::Compiled(compiled) => &compiled.name,
         }
     }
 
@@ -51,6 +40,7 @@ impl Function {
         match self {
             Function::Bytecode(bytecode) => bytecode.arity,
             Function::Native(native) => native.arity,
+            Function::Compiled(compiled) => compiled.arity,
         }
     }
 
@@ -63,7 +53,7 @@ impl Function {
         }
 
         match self {
-            Function::Bytecode(_) => s += ") { /* bytecode */ }",
+            Function::Bytecode(_) | Function::Compiled(_) => s += ") { /* bytecode */ }",
             Function::Native(_) => s += ") { /* machine code */ }",
         }
 
@@ -71,7 +61,7 @@ impl Function {
     }
 
     pub fn is_bytecode(&self) -> bool {
-        matches!(self, &Function::Bytecode(_))
+        matches!(self, &Function::Bytecode(_) | &Function::Compiled(_))
     }
 }
 
@@ -79,6 +69,8 @@ impl Function {
 pub struct NativeFunction {
     pub name: Cow<'static, str>,
     pub arity: u64,
+    /// Pops exactly `arity` arguments and pushes exactly one result, which `verify` counts on for
+    /// every call
     pub fun_ptr: fn(&mut Runtime) -> (),
 }
 
@@ -105,12 +97,16 @@ impl PartialEq for NativeFunction {
 
 impl Eq for NativeFunction {}
 
+/// A function run by the instructions engine. Every call shares the same code, and gets a window
+/// of `frame_size` locals on the runtime's locals stack, so cloning it is just bumping two
+/// refcounts. `max_stack` is how much of the value stack a call can use on top of that.
 #[derive(Clone, Debug)]
 pub struct BytecodeFunction {
-    pub name: String,
+    pub name: Rc<str>,
     pub arity: u64,
-    pub code: Block,
-    pub locals: Vec<Value>,
+    pub frame_size: u64,
+    pub max_stack: u64,
+    pub code: Rc<Block>,
 }
 
 impl Hash for BytecodeFunction {
@@ -127,25 +123,41 @@ impl PartialEq for BytecodeFunction {
 
 impl Eq for BytecodeFunction {}
 
-impl BytecodeFunction {
-    pub fn get_local(&self, local_idx: u64) -> Value {
-        self.locals
-            .get(local_idx as usize)
-            .map(|v| v.clone())
-            .unwrap_or(Value::Null)
+#[derive(Clone, Default, Debug)]
+pub struct Block(pub Vec<Instruction>);
+
+/// A function in a Chunk, run by the threaded engine. Cloning it is just bumping two refcounts.
+#[derive(Clone)]
+pub struct CompiledFunction {
+    pub name: Rc<str>,
+    pub arity: u64,
+    pub chunk: Rc<Chunk>,
+    pub index: u32,
+}
+
+impl Debug for CompiledFunction {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("CompiledFunction")
+            .field("name", &self.name)
+            .field("arity", &self.arity)
+            .field("index", &self.index)
+            .finish()
     }
+}
 
-    pub fn set_local(&mut self, local_idx: u64, val: Value) {
-        while self.locals.len() < (local_idx + 1) as usize {
-            self.locals.push(Value::Null);
-        }
+impl Hash for CompiledFunction {
+    fn hash<H: std::hash::Hasher>(&self, state: &mut H) {
+        self.name.hash(state);
+    }
+}
 
-        self.locals[local_idx as usize] = val;
+impl PartialEq for CompiledFunction {
+    fn eq(&self, other: &Self) -> bool {
+        self.name == other.name
     }
 }
 
-#[derive(Clone, Default, Debug)]
-pub struct Block(pub Vec<Instruction>);
+impl Eq for CompiledFunction {}
 
 impl Value {
     pub fn kindof(&self) -> Self {
@@ -350,6 +362,11 @@ impl Value {
                 (self::Function::Native(a), self::Function::Native(b)) => {
                     a.name.partial_cmp(&b.name)
                 }
+                (self::Function::Compiled(a), self::Function::Compiled(b)) => {
+                    a.name.partial_cmp(&b.name)
+                }
+                (self::Function::Compiled(_), _) => None,
+                (_, self::Function::Compiled(_)) => None,
             },
             (Function(_), _) => None,
             (_, Function(_)) => None,
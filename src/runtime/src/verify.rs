@@ -0,0 +1,459 @@
+//! Checks a file's code once, when it's loaded, so that neither engine has to check it again
+//! every time it runs. Accepted code only ever:
+//!
+//! - jumps somewhere inside the function (or top level) it's in, and runs off the end of
+//!   neither
+//! - agrees with itself on how much is on the stack wherever two paths meet, never pops what
+//!   isn't there, returns with nothing but the returned value, and stays within `max_stack`
+//! - uses locals below its `frame_size`, and only refers to globals, strings, integers and
+//!   functions its file actually has
+//!
+//! These are the same rules src/codegen/stack_depth.cpp holds codegen to, so anything it
+//! produced passes.
+
+use std::error::Error;
+
+use crate::{
+    bytecode::{opcode, Chunk},
+    instruction::{Instruction, Module},
+};
+
+/// What one instruction does, as far as the verifier cares
+struct Step {
+    pops: u64,
+    pushes: u64,
+    flow: Flow,
+}
+
+enum Flow {
+    Next,
+    /// Always goes to the target, which is `None` when the offset points outside the code
+    Jump(Option<usize>),
+    /// Goes to the target or the next instruction
+    Branch(Option<usize>),
+    Return,
+}
+
+impl Step {
+    fn new(pops: u64, pushes: u64) -> Step {
+        Step {
+            pops,
+            pushes,
+            flow: Flow::Next,
+        }
+    }
+
+    fn flow(pops: u64, pushes: u64, flow: Flow) -> Step {
+        Step { pops, pushes, flow }
+    }
+}
+
+/// One function's code, or a file's top level when `max_stack` is `None`
+struct Body {
+    start: usize,
+    end: usize,
+    frame_size: u64,
+    max_stack: Option<u64>,
+}
+
+impl Body {
+    fn top_level(len: usize) -> Body {
+        Body {
+            start: 0,
+            end: len,
+            frame_size: 0,
+            max_stack: None,
+        }
+    }
+
+    fn local(&self, at: usize, index: u64) -> Result<(), Box<dyn Error>> {
+        if index < self.frame_size {
+            Ok(())
+        } else {
+            Err(format!(
+                "instruction {} uses local {}, but its function only has {}",
+                at, index, self.frame_size
+            )
+            .into())
+        }
+    }
+}
+
+fn forwards(at: usize, offset: u64) -> Option<usize> {
+    at.checked_add(offset as usize)
+}
+
+fn backwards(at: usize, offset: u64) -> Option<usize> {
+    at.checked_sub(offset as usize)
+}
+
+fn in_range(at: usize, what: &str, index: u64, len: usize) -> Result<(), Box<dyn Error>> {
+    if (index as usize) < len {
+        Ok(())
+    } else {
+        Err(format!("instruction {} refers to a {} that doesn't exist", at, what).into())
+    }
+}
+
+/// Follows every path through the body from its start, where the stack is empty. `step` checks
+/// an instruction's operands and says what it does.
+fn check_paths(
+    body: &Body,
+    mut step: impl FnMut(usize) -> Result<Step, Box<dyn Error>>,
+) -> Result<(), Box<dyn Error>> {
+    let in_function = body.max_stack.is_some();
+
+    if body.start == body.end {
+        return if in_function {
+            Err(format!("function at {} has no code", body.start).into())
+        } else {
+            Ok(())
+        };
+    }
+
+    // How much is on the stack before each instruction, once some path has gotten there
+    let mut before: Vec<Option<u64>> = vec![None; body.end - body.start];
+    let mut work = vec![body.start];
+    before[0] = Some(0);
+
+    while let Some(at) = work.pop() {
+        let depth = before[at - body.start].unwrap();
+        let effect = step(at)?;
+
+        if effect.pops > depth {
+            return Err(format!("instruction {} pops more than is on the stack", at).into());
+        }
+
+        let after = depth - effect.pops + effect.pushes;
+        if let Some(max_stack) = body.max_stack {
+            if after > max_stack {
+                return Err(format!(
+                    "instruction {} needs more than the {} stack slots its function has",
+                    at, max_stack
+                )
+                .into());
+            }
+        }
+
+        // Where it can go next, `None` being somewhere that isn't in the code at all
+        let (targets, count) = match effect.flow {
+            Flow::Next => ([Some(at + 1), None], 1),
+            Flow::Jump(to) => ([to, None], 1),
+            Flow::Branch(to) => ([Some(at + 1), to], 2),
+            Flow::Return => {
+                if !in_function {
+                    return Err(format!("instruction {} returns from the top level", at).into());
+                } else if depth != 1 {
+                    return Err(format!(
+                        "instruction {} returns with {} values on the stack",
+                        at, depth
+                    )
+                    .into());
+                }
+
+                continue;
+            }
+        };
+
+        for &to in &targets[..count] {
+            if to == Some(body.end) && !in_function && after == 0 {
+                continue;
+            }
+
+            let to = match to {
+                Some(to) if to >= body.start && to < body.end => to,
+                _ => return Err(format!("instruction {} goes outside of its function", at).into()),
+            };
+
+            match before[to - body.start] {
+                None => {
+                    before[to - body.start] = Some(after);
+                    work.push(to);
+                }
+                Some(seen) if seen != after => {
+                    return Err(format!(
+                        "instruction {} is reached with both {} and {} values on the stack",
+                        to, seen, after
+                    )
+                    .into())
+                }
+                Some(_) => {}
+            }
+        }
+    }
+
+    Ok(())
+}
+
+pub fn verify_module(module: &Module) -> Result<(), Box<dyn Error>> {
+    let insns = &module.instructions;
+    let globals = module.globals.len();
+
+    let top_level = Body::top_level(insns.len());
+    check_paths(&top_level, |at| module_step(insns, globals, &top_level, at))?;
+
+    for (at, insn) in insns.iter().enumerate() {
+        if let Instruction::DefineFunction {
+            param_count,
+            code_size,
+            frame_size,
+            max_stack,
+            ..
+        } = insn
+        {
+            let body = Body {
+                start: at + 1,
+                end: forwards(at + 1, *code_size)
+                    .filter(|&end| end <= insns.len())
+                    .ok_or_else(|| format!("function at {} runs past the end", at))?,
+                frame_size: *frame_size,
+                max_stack: Some(*max_stack),
+            };
+
+            if param_count > frame_size {
+                return Err(format!("function at {} has fewer locals than parameters", at).into());
+            }
+
+            check_paths(&body, |at| module_step(insns, globals, &body, at))?;
+        }
+    }
+
+    Ok(())
+}
+
+fn module_step(
+    insns: &[Instruction],
+    globals: usize,
+    body: &Body,
+    at: usize,
+) -> Result<Step, Box<dyn Error>> {
+    Ok(match &insns[at] {
+        Instruction::DefineFunction { code_size, .. } => {
+            if body.max_stack.is_some() {
+                return Err(format!("instruction {} defines a function in a function", at).into());
+            }
+
+            // The function's own body gets checked on its own
+            Step::flow(0, 0, Flow::Jump(forwards(at + 1, *code_size)))
+        }
+        Instruction::Return => Step::flow(1, 0, Flow::Return),
+        Instruction::CallKnownFunction { arg_count, .. } => Step::new(*arg_count, 1),
+        Instruction::CallUnknownFunction { arg_count } => Step::new(*arg_count + 1, 1),
+        Instruction::CallDirectFunction { arg_count, slot } => {
+            in_range(at, "global", *slot, globals)?;
+            Step::new(*arg_count, 1)
+        }
+        Instruction::NullConst
+        | Instruction::BooleanConst(_)
+        | Instruction::IntegerConst(_)
+        | Instruction::StringConst(_) => Step::new(0, 1),
+        Instruction::ListCount { count } => Step::new(*count, 1),
+        Instruction::GetLocal { local_idx } => {
+            body.local(at, *local_idx)?;
+            Step::new(0, 1)
+        }
+        Instruction::SetLocal { local_idx } => {
+            body.local(at, *local_idx)?;
+            Step::new(1, 0)
+        }
+        Instruction::TeeLocal { local_idx } => {
+            body.local(at, *local_idx)?;
+            Step::new(1, 1)
+        }
+        Instruction::Jump { offset } => Step::flow(0, 0, Flow::Jump(forwards(at, *offset))),
+        Instruction::JumpIfFalse { offset } => {
+            Step::flow(1, 0, Flow::Branch(forwards(at, *offset)))
+        }
+        Instruction::Loop { offset } => Step::flow(0, 0, Flow::Jump(backwards(at, *offset))),
+        Instruction::GetGlobal { slot } => {
+            in_range(at, "global", *slot, globals)?;
+            Step::new(0, 1)
+        }
+        Instruction::SetGlobal { slot } => {
+            in_range(at, "global", *slot, globals)?;
+            Step::new(1, 0)
+        }
+        Instruction::Import | Instruction::Drop | Instruction::Global => Step::new(1, 0),
+        Instruction::GetFree | Instruction::Negate | Instruction::Not => Step::new(1, 1),
+        Instruction::SetFree => Step::new(2, 0),
+        Instruction::Add
+        | Instruction::Sub
+        | Instruction::Mul
+        | Instruction::Div
+        | Instruction::Mod
+        | Instruction::Eq
+        | Instruction::Ne
+        | Instruction::Lt
+        | Instruction::Le
+        | Instruction::Gt
+        | Instruction::Ge
+        | Instruction::And
+        | Instruction::Or
+        | Instruction::Index => Step::new(2, 1),
+        Instruction::IndexSet => Step::new(3, 0),
+    })
+}
+
+pub fn verify_chunk(chunk: &Chunk) -> Result<(), Box<dyn Error>> {
+    let code = chunk.code();
+
+    let top_level = Body::top_level(code.len());
+    check_paths(&top_level, |at| chunk_step(chunk, &top_level, at))?;
+
+    for (index, entry) in chunk.functions().iter().enumerate() {
+        let start = entry.start as usize;
+        let body = Body {
+            start,
+            end: forwards(start, entry.size as u64)
+                .filter(|&end| start > 0 && end <= code.len())
+                .ok_or_else(|| format!("function {} is out of bounds", index))?,
+            frame_size: entry.frame_size as u64,
+            max_stack: Some(entry.max_stack as u64),
+        };
+
+        if entry.parm_count > entry.frame_size {
+            return Err(format!("function {} has fewer locals than parameters", index).into());
+        }
+
+        check_paths(&body, |at| chunk_step(chunk, &body, at))?;
+    }
+
+    Ok(())
+}
+
+fn chunk_step(chunk: &Chunk, body: &Body, at: usize) -> Result<Step, Box<dyn Error>> {
+    let op = chunk.code()[at];
+    let operand = op.operand as u64;
+    let globals = chunk.globals().len();
+
+    Ok(match op.opcode {
+        opcode::DEFINE_FUNCTION => {
+            if body.max_stack.is_some() {
+                return Err(format!("instruction {} defines a function in a function", at).into());
+            }
+
+            in_range(at, "function", operand, chunk.functions().len())?;
+            let entry = chunk.functions()[op.operand as usize];
+            if entry.start as usize != at + 1 {
+                return Err(format!("instruction {} defines a function somewhere else", at).into());
+            }
+
+            Step::flow(0, 0, Flow::Jump(forwards(at + 1, entry.size as u64)))
+        }
+        opcode::RETURN => Step::flow(1, 0, Flow::Return),
+        opcode::CALL_KNOWN => {
+            in_range(at, "string", operand, chunk.string_count())?;
+            Step::new(op.count as u64, 1)
+        }
+        opcode::CALL_UNKNOWN => Step::new(operand + 1, 1),
+        opcode::CALL_DIRECT => {
+            in_range(at, "global", operand, globals)?;
+            Step::new(op.count as u64, 1)
+        }
+        opcode::NULL_CONST | opcode::BOOLEAN_CONST => Step::new(0, 1),
+        opcode::INTEGER_CONST => {
+            in_range(at, "integer", operand, chunk.integers().len())?;
+            Step::new(0, 1)
+        }
+        opcode::STRING_CONST => {
+            in_range(at, "string", operand, chunk.string_count())?;
+            Step::new(0, 1)
+        }
+        opcode::LIST_CONST => Step::new(operand, 1),
+        opcode::GET_LOCAL => {
+            body.local(at, operand)?;
+            Step::new(0, 1)
+        }
+        opcode::SET_LOCAL => {
+            body.local(at, operand)?;
+            Step::new(1, 0)
+        }
+        opcode::TEE_LOCAL => {
+            body.local(at, operand)?;
+            Step::new(1, 1)
+        }
+        opcode::JUMP => Step::flow(0, 0, Flow::Jump(forwards(at, operand))),
+        opcode::JUMP_IF_FALSE => Step::flow(1, 0, Flow::Branch(forwards(at, operand))),
+        opcode::LOOP => Step::flow(0, 0, Flow::Jump(backwards(at, operand))),
+        opcode::GET_GLOBAL => {
+            in_range(at, "global", operand, globals)?;
+            Step::new(0, 1)
+        }
+        opcode::SET_GLOBAL => {
+            in_range(at, "global", operand, globals)?;
+            Step::new(1, 0)
+        }
+        opcode::IMPORT | opcode::DROP | opcode::GLOBAL => Step::new(1, 0),
+        opcode::GET_FREE | opcode::NEGATE | opcode::NOT => Step::new(1, 1),
+        opcode::SET_FREE => Step::new(2, 0),
+        opcode::ADD
+        | opcode::SUB
+        | opcode::MUL
+        | opcode::DIV
+        | opcode::MOD
+        | opcode::EQ
+        | opcode::NE
+        | opcode::LT
+        | opcode::LE
+        | opcode::GT
+        | opcode::GE
+        | opcode::AND
+        | opcode::OR
+        | opcode::INDEX => Step::new(2, 1),
+        opcode::INDEX_SET => Step::new(3, 0),
+        unk => return Err(format!("instruction {} has unknown opcode {}", at, unk).into()),
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use std::path::PathBuf;
+
+    use crate::{
+        instruction::{Instruction, Module},
+        intrinsics::INTRINSICS,
+        runtime::{Program, Runtime},
+        value::Value,
+    };
+
+    /// `==[]` is the one intrinsic that's also an instruction, which pushes nothing. Called as a
+    /// function it has to push a result like any other call, or the Drop verify expects after
+    /// it takes the 42 that `main` returns.
+    #[test]
+    fn index_set_call_pushes_a_result() {
+        let module = Module {
+            instructions: vec![
+                Instruction::DefineFunction {
+                    param_count: 1,
+                    identifier: "main".into(),
+                    code_size: 8,
+                    frame_size: 1,
+                    max_stack: 4,
+                },
+                Instruction::IntegerConst(42),
+                Instruction::IntegerConst(7),
+                Instruction::IntegerConst(0),
+                Instruction::ListCount { count: 1 },
+                Instruction::IntegerConst(0),
+                Instruction::CallKnownFunction {
+                    arg_count: 3,
+                    identifier: "==[]".into(),
+                    function: 0,
+                },
+                Instruction::Drop,
+                Instruction::Return,
+            ],
+            globals: vec![],
+        };
+        super::verify_module(&module).unwrap();
+
+        let mut runtime = Runtime::create(
+            Box::new(|_, _| Ok(None)),
+            INTRINSICS,
+            Value::Null,
+            PathBuf::new(),
+        );
+        runtime.execute_program(Program::Instructions(module));
+        assert!(matches!(runtime.exit_value(), Value::Integer(42)));
+    }
+}
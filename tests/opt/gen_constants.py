@@ -0,0 +1,55 @@
+"""Writes a program that prints a handful of random expressions built mostly out of literals, so
+constant folding has plenty to fold, including the corners where it has to give up: overflow,
+division by zero, and operators on mixed kinds. run.sh writes one of these for each of its seeds.
+
+usage: python3 tests/opt/gen_constants.py SEED > SEED.merc
+"""
+
+import random
+import sys
+
+OPS = ['+', '-', '*', '/', '%', '==', '!=', '<', '<=', '>', '>=', '&', '|']
+INTEGERS = [0, 1, 2, 3, -1, 7, 100, 9223372036854775807, -9223372036854775807]
+STRINGS = ['"ab"', '""', '"é"', '"10"', '" 3"', '"z"']
+
+
+def literal(depth):
+    r = random.random()
+    if r < 0.3:
+        return str(random.choice(INTEGERS))
+    if r < 0.5:
+        return random.choice(STRINGS)
+    if r < 0.6:
+        return random.choice(['true', 'false'])
+    if r < 0.7:
+        return 'null'
+    if r < 0.8 and depth < 2:
+        return '[' + ', '.join(expression(depth + 1) for _ in range(random.randint(0, 3))) + ']'
+    # Something that can't be folded, to see it stop at the right place
+    return 'x'
+
+
+def expression(depth=0):
+    r = random.random()
+    if depth > 3 or r < 0.3:
+        return literal(depth)
+    if r < 0.45:
+        return random.choice(['!', '-']) + '(' + expression(depth + 1) + ')'
+    if r < 0.5:
+        elements = ', '.join(expression(depth + 1) for _ in range(random.randint(1, 3)))
+        return '[' + elements + '][' + random.choice(['0', '1', 'true']) + ']'
+    return '(' + expression(depth + 1) + ' ' + random.choice(OPS) + ' ' + expression(depth + 1) + ')'
+
+
+def main():
+    random.seed(int(sys.argv[1]))
+    print('function show(v) {\n\tdo print(v);\n\tdo print("\\n");\n}\n')
+    print('function main(argv) {')
+    print('\tlet x = ' + random.choice(['3', '"s"', 'true', 'null', '[1]']) + ';')
+    for _ in range(8):
+        print('\tdo show(' + expression() + ');')
+    print('}')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Runs every program in tests/opt with merc at -O0 and at -O1, on both engines, and fails if
+# optimizing changed what any of them prints or exits with. Whatever the unoptimized pipeline
+# does is the golden output, errors included. Along with the programs checked in here, it runs
+# the ones gen_constants.py writes for a fixed set of seeds, so a failure always reproduces.
+#
+# usage: tests/opt/run.sh [path/to/merc]
+
+merc=${1:-src/runtime/target/release/merc}
+dir=$(dirname "$0")
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+mkdir "$out/generated"
+for seed in $(seq 1 40); do
+	python3 "$dir/gen_constants.py" $seed > "$out/generated/$seed.merc" || exit 1
+done
+
+failed=0
+count=0
+for file in "$dir"/*.merc "$out"/generated/*.merc; do
+	for engine in threaded instructions; do
+		"$merc" --engine $engine --opt-level 0 "$file" > "$out/O0" 2>/dev/null
+		O0=$?
+		"$merc" --engine $engine --opt-level 1 "$file" > "$out/O1" 2>/dev/null
+		O1=$?
+
+		if [ $O0 != $O1 ] || ! cmp -s "$out/O0" "$out/O1"; then
+			echo "FAIL $file ($engine): -O0 exited $O0, -O1 exited $O1"
+			diff "$out/O0" "$out/O1" | head -10
+			failed=$((failed + 1))
+		fi
+		count=$((count + 1))
+	done
+done
+
+echo "$((count - failed)) of $count runs matched"
+[ $failed = 0 ]